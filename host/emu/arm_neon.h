@@ -0,0 +1,274 @@
+/*
+ * Plain C versions of the NEON intrinsics used by ws2812-neon.c, so the
+ * host tests can run it on machines without NEON.  Only the intrinsics
+ * the driver uses are here, with the same lane semantics.
+ */
+
+#ifndef _EMU_ARM_NEON_H
+#define _EMU_ARM_NEON_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct { uint8_t v[8]; } uint8x8_t;
+typedef struct { uint16_t v[4]; } uint16x4_t;
+typedef struct { uint32_t v[4]; } uint32x4_t;
+typedef struct { uint16_t v[8]; } uint16x8_t;
+
+typedef struct { uint8x8_t val[2]; } uint8x8x2_t;
+typedef struct { uint16x4_t val[2]; } uint16x4x2_t;
+typedef struct { uint32x4_t val[3]; } uint32x4x3_t;
+typedef struct { uint32x4_t val[4]; } uint32x4x4_t;
+typedef struct { uint8x8_t val[4]; } uint8x8x4_t;
+
+static inline uint8x8_t vld1_u8(const uint8_t *p)
+{
+	uint8x8_t r;
+
+	memcpy(r.v, p, sizeof(r.v));
+	return r;
+}
+
+static inline uint8x8_t vdup_n_u8(uint8_t x)
+{
+	uint8x8_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		r.v[i] = x;
+	return r;
+}
+
+static inline uint8x8_t vand_u8(uint8x8_t a, uint8x8_t b)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		a.v[i] &= b.v[i];
+	return a;
+}
+
+static inline uint8x8_t vshr_n_u8(uint8x8_t a, int n)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		a.v[i] >>= n;
+	return a;
+}
+
+/* Out of range indexes give 0 */
+static inline uint8x8_t vtbl1_u8(uint8x8_t t, uint8x8_t idx)
+{
+	uint8x8_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		r.v[i] = idx.v[i] < 8 ? t.v[idx.v[i]] : 0;
+	return r;
+}
+
+static inline uint8x8x2_t vzip_u8(uint8x8_t a, uint8x8_t b)
+{
+	uint8_t t[16];
+	uint8x8x2_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		t[2 * i] = a.v[i];
+		t[2 * i + 1] = b.v[i];
+	}
+	memcpy(r.val[0].v, t, 8);
+	memcpy(r.val[1].v, t + 8, 8);
+	return r;
+}
+
+static inline uint16x4x2_t vzip_u16(uint16x4_t a, uint16x4_t b)
+{
+	uint16_t t[8];
+	uint16x4x2_t r;
+	int i;
+
+	for(i = 0; i < 4; i++)
+	{
+		t[2 * i] = a.v[i];
+		t[2 * i + 1] = b.v[i];
+	}
+	memcpy(r.val[0].v, t, 8);
+	memcpy(r.val[1].v, t + 4, 8);
+	return r;
+}
+
+/* Reinterpretation keeps the bytes, lanes are little endian like ARM */
+static inline uint16x4_t vreinterpret_u16_u8(uint8x8_t a)
+{
+	uint16x4_t r;
+
+	memcpy(r.v, a.v, 8);
+	return r;
+}
+
+static inline uint16x8_t vcombine_u16(uint16x4_t lo, uint16x4_t hi)
+{
+	uint16x8_t r;
+
+	memcpy(r.v, lo.v, 8);
+	memcpy(r.v + 4, hi.v, 8);
+	return r;
+}
+
+static inline uint32x4_t vreinterpretq_u32_u16(uint16x8_t a)
+{
+	uint32x4_t r;
+
+	memcpy(r.v, a.v, 16);
+	return r;
+}
+
+static inline void vst3q_u32(uint32_t *p, uint32x4x3_t x)
+{
+	int i, c;
+
+	for(i = 0; i < 4; i++)
+		for(c = 0; c < 3; c++)
+			*p++ = x.val[c].v[i];
+}
+
+static inline void vst4q_u32(uint32_t *p, uint32x4x4_t x)
+{
+	int i, c;
+
+	for(i = 0; i < 4; i++)
+		for(c = 0; c < 4; c++)
+			*p++ = x.val[c].v[i];
+}
+
+/* De-interleave 8 groups of 4 bytes into one vector per byte */
+static inline uint8x8x4_t vld4_u8(const uint8_t *p)
+{
+	uint8x8x4_t r;
+	int i, c;
+
+	for(i = 0; i < 8; i++)
+		for(c = 0; c < 4; c++)
+			r.val[c].v[i] = *p++;
+	return r;
+}
+
+static inline void vst4_u8(uint8_t *p, uint8x8x4_t x)
+{
+	int i, c;
+
+	for(i = 0; i < 8; i++)
+		for(c = 0; c < 4; c++)
+			*p++ = x.val[c].v[i];
+}
+
+static inline uint8x8_t vmvn_u8(uint8x8_t a)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		a.v[i] = ~a.v[i];
+	return a;
+}
+
+static inline uint8x8_t vqadd_u8(uint8x8_t a, uint8x8_t b)
+{
+	int i, sum;
+
+	for(i = 0; i < 8; i++)
+	{
+		sum = a.v[i] + b.v[i];
+		a.v[i] = sum > 255 ? 255 : sum;
+	}
+	return a;
+}
+
+static inline uint16x8_t vmull_u8(uint8x8_t a, uint8x8_t b)
+{
+	uint16x8_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		r.v[i] = a.v[i] * b.v[i];
+	return r;
+}
+
+/* Accumulates modulo 2^16 like the real instruction */
+static inline uint16x8_t vmlal_u8(uint16x8_t acc, uint8x8_t a, uint8x8_t b)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		acc.v[i] += a.v[i] * b.v[i];
+	return acc;
+}
+
+/* Rounding shift, the rounding add does not overflow the lane */
+static inline uint16x8_t vrshrq_n_u16(uint16x8_t a, int n)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		a.v[i] = ((uint32_t) a.v[i] + (1U << (n - 1))) >> n;
+	return a;
+}
+
+/* Rounding add returning bits 15:8 of each sum */
+static inline uint8x8_t vraddhn_u16(uint16x8_t a, uint16x8_t b)
+{
+	uint8x8_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		r.v[i] = ((uint32_t) a.v[i] + b.v[i] + 128) >> 8;
+	return r;
+}
+
+static inline uint16x8_t vdupq_n_u16(uint16_t x)
+{
+	uint16x8_t r;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		r.v[i] = x;
+	return r;
+}
+
+static inline uint32x4_t vdupq_n_u32(uint32_t x)
+{
+	uint32x4_t r;
+	int i;
+
+	for(i = 0; i < 4; i++)
+		r.v[i] = x;
+	return r;
+}
+
+static inline uint16x8_t vaddw_u8(uint16x8_t a, uint8x8_t b)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		a.v[i] += b.v[i];
+	return a;
+}
+
+/* Add pairs of adjacent lanes into the wider accumulator */
+static inline uint32x4_t vpadalq_u16(uint32x4_t acc, uint16x8_t a)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		acc.v[i] += a.v[2 * i] + a.v[2 * i + 1];
+	return acc;
+}
+
+static inline uint32_t vgetq_lane_u32(uint32x4_t a, int n)
+{
+	return a.v[n];
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ * Host test for the ws2812 encoders
+ *
+ * Runs random RGB32 pixels through the NEON batch encoder followed by the
+ * scalar encoder for the tail, the way ws2812_encode() does, and checks
+ * the result is byte for byte what the scalar encoder produces alone.
+ * Both are also checked against the bit stream the strip should see,
+ * built one symbol at a time.  The same is done for the encoders of every
+ * pixel layout the driver supports.
+ *
+ * The NEON layer blend is checked against the scalar blend for every
+ * combination of source, destination and alpha in both modes, and the
+ * scalar blend against exact rounded arithmetic.
+ *
+ * Rows summed by the NEON sampling kernel with the scalar tail are checked
+ * against plain sums, and the scaled averages against exact rounded
+ * division for every rectangle area the driver accepts.  Whole rectangles
+ * are averaged with and without NEON, including ones summed in several
+ * chunks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2812.h"
+#include "ws2812-encode.h"
+
+#define ARRAY_SIZE(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+#define MAX_LEDS 67
+// Widest sampled rectangle
+#define MAX_WIDTH 65535
+#define MAX_WORDS (MAX_LEDS * WS2812_MAX_CHANNELS * BYTES_PER_CHANNEL / 4)
+
+static uint8_t lut[WS2812_MAX_CHANNELS][256];
+static uint32_t pixels[MAX_LEDS];
+static int failures;
+
+/*
+ * The bit stream for count LEDs packed into words the way the PWM sends
+ * them, bit 31 of a word first
+ */
+static void reference_encode(const uint8_t *shift, int channels, int symbols,
+                             int count, uint32_t *out)
+{
+	uint32_t one = symbols == 3 ? 0x6 : 0xe;
+	uint32_t zero = symbols == 3 ? 0x4 : 0x8;
+	int led, c, b, s, k = 0;
+	uint32_t sym;
+	uint8_t val;
+
+	memset(out, 0, MAX_WORDS * 4);
+
+	for(led = 0; led < count; led++)
+		for(c = 0; c < channels; c++)
+		{
+			val = lut[c][(pixels[led] >> shift[c]) & 0xff];
+			for(b = 7; b >= 0; b--)
+			{
+				sym = (val >> b) & 1 ? one : zero;
+				for(s = symbols - 1; s >= 0; s--, k++)
+					if((sym >> s) & 1)
+						out[k / 32] |= 1U << (31 - k % 32);
+			}
+		}
+}
+
+static void scalar_encode(const uint8_t *shift, int channels,
+                          const uint32_t *px, unsigned char *buf, int count)
+{
+	int c;
+
+	while(count--)
+	{
+		for(c = 0; c < channels; c++)
+			buf = channel_encode(lut[c][(*px >> shift[c]) & 0xff], buf);
+		px++;
+	}
+}
+
+static void scalar_encode3(const uint8_t *shift, int channels,
+                           unsigned char *base, int count)
+{
+	int led, c, pos = 0;
+
+	for(led = 0; led < count; led++)
+		for(c = 0; c < channels; c++)
+			pos = channel_encode3(lut[c][(pixels[led] >> shift[c]) & 0xff],
+			                      base, pos);
+}
+
+static void check(const char *what, const uint8_t *shift, int channels,
+                  int symbols, int count, const void *got, const void *want)
+{
+	if(memcmp(got, want, MAX_WORDS * 4) == 0)
+		return;
+
+	if(failures++ < 10)
+		printf("FAIL %s: %d channels, shifts %d %d %d %d, %d symbols, %d LEDs\n",
+		       what, channels, shift[0], shift[1], shift[2], shift[3],
+		       symbols, count);
+}
+
+static void test_encode(const uint8_t *shift, int channels, int count)
+{
+	uint32_t ref[MAX_WORDS], scalar[MAX_WORDS], neon[MAX_WORDS];
+	int done;
+
+	reference_encode(shift, channels, 4, count, ref);
+
+	memset(scalar, 0, sizeof(scalar));
+	scalar_encode(shift, channels, pixels, (unsigned char *) scalar, count);
+	check("scalar", shift, channels, 4, count, scalar, ref);
+
+	memset(neon, 0, sizeof(neon));
+	done = ws2812_encode_neon((const uint8_t (*)[256]) lut, shift, channels,
+	                          pixels, neon, count);
+	scalar_encode(shift, channels, pixels + done,
+	              (unsigned char *) (neon + done * channels), count - done);
+	check("neon", shift, channels, 4, count, neon, scalar);
+
+	reference_encode(shift, channels, 3, count, ref);
+
+	memset(scalar, 0, sizeof(scalar));
+	scalar_encode3(shift, channels, (unsigned char *) scalar, count);
+	check("scalar3", shift, channels, 3, count, scalar, ref);
+}
+
+/*
+ * The generated encoders of a layout, the NEON encoder with its shifts, and
+ * the 3 symbol encoder restarted part way through the strip the way a
+ * dirty range is encoded
+ */
+static void test_layout(const struct ws2812_layout * layout, int count)
+{
+	uint32_t ref[MAX_WORDS], scalar[MAX_WORDS], neon[MAX_WORDS];
+	const uint8_t (*table)[256] = (const uint8_t (*)[256]) lut;
+	const uint8_t *shift = layout->shift;
+	int channels = layout->channels;
+	int done, split;
+
+	reference_encode(shift, channels, 4, count, ref);
+
+	memset(scalar, 0, sizeof(scalar));
+	layout->encode(table, pixels, (unsigned char *) scalar, count);
+	check(layout->order, shift, channels, 4, count, scalar, ref);
+
+	memset(neon, 0, sizeof(neon));
+	done = ws2812_encode_neon(table, shift, channels, pixels, neon, count);
+	layout->encode(table, pixels + done,
+	               (unsigned char *) (neon + done * channels), count - done);
+	check(layout->order, shift, channels, 4, count, neon, scalar);
+
+	reference_encode(shift, channels, 3, count, ref);
+
+	split = count / 3;
+	memset(scalar, 0, sizeof(scalar));
+	layout->encode3(table, pixels, (unsigned char *) scalar, 0, split);
+	layout->encode3(table, pixels + split, (unsigned char *) scalar, split,
+	                count - split);
+	check(layout->order, shift, channels, 3, count, scalar, ref);
+}
+
+/* x / 255 rounded to nearest, halves up */
+static uint32_t exact_div255(uint32_t x)
+{
+	return (2 * x + 255) / 510;
+}
+
+static uint32_t exact_blend(uint32_t d, uint32_t c, uint32_t a, u32 mode)
+{
+	uint32_t out;
+
+	if(mode != WS2812_BLEND_ADD)
+		return exact_div255(d * (255 - a) + c * a);
+
+	out = d + exact_div255(c * a);
+	return out > 255 ? 255 : out;
+}
+
+/*
+ * Every source value against every destination value for each alpha, the
+ * other channels carry the same values permuted so each one is covered
+ * in full.  The white byte of the destination covers the scaling by
+ * 255 - alpha.
+ */
+static int test_blend(u32 mode)
+{
+	uint32_t src[256], dst[256], scalar[256], neon[256];
+	uint32_t a, c, d, want;
+	int done, fails = 0;
+
+	for(a = 0; a < 256; a++)
+		for(c = 0; c < 256; c++)
+		{
+			for(d = 0; d < 256; d++)
+			{
+				src[d] = a << 24 | c << 16 | (c ^ 0x5a) << 8 | (255 - c);
+				dst[d] = d << 24 | d << 16 | (d ^ 0xa5) << 8 | (255 - d);
+			}
+
+			memcpy(scalar, dst, sizeof(dst));
+			ws2812_blend_scalar(scalar, src, mode, 256);
+
+			memcpy(neon, dst, sizeof(dst));
+			done = ws2812_blend_neon(neon, src, mode, 256);
+			ws2812_blend_scalar(neon + done, src + done, mode, 256 - done);
+
+			if(memcmp(neon, scalar, sizeof(scalar)) && fails++ < 10)
+				printf("FAIL blend mode %u: neon, alpha %u, source %u\n",
+				       mode, a, c);
+
+			for(d = 0; d < 256; d++)
+			{
+				want = exact_blend(d, c, a, mode);
+				if(((scalar[d] >> 16) & 0xff) != want && fails++ < 10)
+					printf("FAIL blend mode %u: %u over %u at alpha %u gives %u, not %u\n",
+					       mode, c, d, a, (scalar[d] >> 16) & 0xff, want);
+
+				want = mode == WS2812_BLEND_ADD ? d : exact_div255(d * (255 - a));
+				if(scalar[d] >> 24 != want && fails++ < 10)
+					printf("FAIL blend mode %u: white %u at alpha %u gives %u, not %u\n",
+					       mode, d, a, scalar[d] >> 24, want);
+			}
+		}
+
+	return fails;
+}
+
+/*
+ * Rows of every width up to a few batches, widths either side of the point
+ * where the 16 bit lanes are folded, and the widest rectangle, filled with
+ * random pixels and with 0xff in every byte
+ */
+static int test_sum(void)
+{
+	static uint32_t row[MAX_WIDTH];
+	static const int wide[] = {
+		256 * WS2812_NEON_BATCH - 1, 256 * WS2812_NEON_BATCH,
+		256 * WS2812_NEON_BATCH + 1, 256 * WS2812_NEON_BATCH + 7,
+		512 * WS2812_NEON_BATCH + 3, 1920, 3840, MAX_WIDTH - 8, MAX_WIDTH,
+	};
+	uint32_t sums[3], want[3];
+	int fill, width, i, c, done, fails = 0;
+
+	for(fill = 0; fill < 2; fill++)
+	{
+		for(i = 0; i < MAX_WIDTH; i++)
+			row[i] = fill ? 0xffffffff : (uint32_t) rand() << 16 ^ rand();
+
+		for(i = 0; i < 8 * WS2812_NEON_BATCH + ARRAY_SIZE(wide); i++)
+		{
+			width = i < 8 * WS2812_NEON_BATCH ? i + 1 : wide[i - 8 * WS2812_NEON_BATCH];
+
+			memset(want, 0, sizeof(want));
+			for(c = 0; c < width; c++)
+			{
+				want[0] += row[c] & 0xff;
+				want[1] += (row[c] >> 8) & 0xff;
+				want[2] += (row[c] >> 16) & 0xff;
+			}
+
+			/* Start from a sum already in progress, as for later rows */
+			for(c = 0; c < 3; c++)
+			{
+				sums[c] = 1000 * c;
+				want[c] += 1000 * c;
+			}
+			done = ws2812_sum_neon(row, width, sums);
+			ws2812_sum_scalar(row + done, width - done, sums);
+
+			if(memcmp(sums, want, sizeof(sums)) && fails++ < 10)
+				printf("FAIL sum: width %d%s gives %u %u %u, not %u %u %u\n",
+				       width, fill ? " of 0xff" : "",
+				       sums[0], sums[1], sums[2], want[0], want[1], want[2]);
+		}
+	}
+
+	return fails;
+}
+
+static int check_scale(uint32_t sum, uint32_t area, uint64_t recip)
+{
+	uint32_t got = ws2812_sample_scale(sum, area, recip);
+	uint32_t want = (2 * sum + area) / (2 * area);
+
+	if(got == want)
+		return 0;
+
+	printf("FAIL scale: sum %u over %u gives %u, not %u\n", sum, area, got, want);
+	return 1;
+}
+
+/*
+ * Every area, for the sums either side of each rounding point as well as
+ * none and the largest
+ */
+static int test_scale(void)
+{
+	uint32_t area, sum, half;
+	uint64_t recip;
+	int k, fails = 0;
+
+	for(area = 1; area <= WS2812_SAMPLE_MAX_AREA && fails < 10; area++)
+	{
+		recip = ((1ULL << 53) + area - 1) / area;
+
+		fails += check_scale(0, area, recip);
+		fails += check_scale(255 * area, area, recip);
+
+		for(k = 0; k < 255; k++)
+		{
+			half = k * area + area / 2;
+			for(sum = half ? half - 1 : half; sum <= half + 1; sum++)
+				fails += check_scale(sum, area, recip);
+		}
+	}
+
+	return fails;
+}
+
+/*
+ * Rectangles of a frame averaged with and without NEON against the
+ * rounded average of their pixels, tall enough that NEON is claimed for
+ * several chunks of rows
+ */
+static int test_average(void)
+{
+	static const struct { int width, height; } sizes[] = {
+		{ 1, 1 }, { 7, 3 }, { 61, 17 }, { 100, 2000 }, { 1999, 300 },
+		{ 4096, 1024 },
+	};
+	struct ws2812_sample_rect rect;
+	uint32_t *frame, want, got[2];
+	uint64_t sums[3];
+	int i, c, x, y, neon, stride, fails = 0;
+
+	for(i = 0; i < ARRAY_SIZE(sizes); i++)
+	{
+		/* Rectangle at 3, 2 of a frame with a padded stride */
+		stride = (sizes[i].width + 5) * 4;
+		frame = malloc((size_t) stride * (sizes[i].height + 2));
+		for(x = 0; x < stride / 4 * (sizes[i].height + 2); x++)
+			frame[x] = (uint32_t) rand() << 16 ^ rand();
+
+		rect.offset = 2 * stride + 3 * 4;
+		rect.width = sizes[i].width;
+		rect.height = sizes[i].height;
+		rect.recip = ((1ULL << 53) + rect.width * rect.height - 1) /
+		             (rect.width * rect.height);
+
+		memset(sums, 0, sizeof(sums));
+		for(y = 0; y < rect.height; y++)
+			for(x = 0; x < rect.width; x++)
+				for(c = 0; c < 3; c++)
+					sums[c] += (frame[(rect.offset + y * stride) / 4 + x] >>
+					            (8 * c)) & 0xff;
+
+		want = 0;
+		for(c = 0; c < 3; c++)
+			want |= (uint32_t) ((2 * sums[c] + rect.width * rect.height) /
+			                    (2 * rect.width * rect.height)) << (8 * c);
+
+		for(neon = 0; neon < 2; neon++)
+		{
+			got[neon] = ws2812_average_rect((const uint8_t *) frame, stride,
+			                                &rect, neon);
+			if(got[neon] != want && fails++ < 10)
+				printf("FAIL average: %dx%d%s gives %06x, not %06x\n",
+				       rect.width, rect.height, neon ? " with neon" : "",
+				       got[neon], want);
+		}
+
+		free(frame);
+	}
+
+	return fails;
+}
+
+static void fill_lut(int kind)
+{
+	int c, v;
+
+	for(c = 0; c < WS2812_MAX_CHANNELS; c++)
+		for(v = 0; v < 256; v++)
+		{
+			switch(kind)
+			{
+				case 0: lut[c][v] = v; break;
+				case 1: lut[c][v] = (v * v) / 255; break;
+				default: lut[c][v] = rand(); break;
+			}
+		}
+}
+
+int main(void)
+{
+	static const uint8_t channel_shifts[] = { 0, 8, 16, 24 };
+	uint8_t shift[WS2812_MAX_CHANNELS];
+	int channels, kind, count, i, a, b, c, d, tests = 0;
+
+	srand(2812);
+
+	for(kind = 0; kind < 3; kind++)
+	{
+		fill_lut(kind);
+
+		/* Every order of every choice of channels from the pixel */
+		for(a = 0; a < 4; a++)
+		for(b = 0; b < 4; b++)
+		for(c = 0; c < 4; c++)
+		for(d = 0; d < 4; d++)
+		{
+			if(a == b || a == c || b == c)
+				continue;
+			/* A fourth channel equal to one of the others means
+			 * 3 channels, test each of those once
+			 */
+			channels = (d == a || d == b || d == c) ? 3 : 4;
+			if(channels == 3 && d != a)
+				continue;
+
+			shift[0] = channel_shifts[a];
+			shift[1] = channel_shifts[b];
+			shift[2] = channel_shifts[c];
+			shift[3] = channels == 4 ? channel_shifts[d] : 0;
+
+			for(count = 0; count < MAX_LEDS; count++)
+			{
+				for(i = 0; i < count; i++)
+					pixels[i] = (uint32_t) rand() << 16 ^ rand();
+				test_encode(shift, channels, count);
+				tests++;
+			}
+		}
+	}
+
+	printf("encode: %d cases, %d failures\n", tests, failures);
+
+	tests = 0;
+	for(kind = 0; kind < 3; kind++)
+	{
+		fill_lut(kind);
+
+		for(i = 0; i < ARRAY_SIZE(ws2812_layouts); i++)
+			for(count = 0; count < MAX_LEDS; count++)
+			{
+				for(a = 0; a < count; a++)
+					pixels[a] = (uint32_t) rand() << 16 ^ rand();
+				test_layout(&ws2812_layouts[i], count);
+				tests++;
+			}
+	}
+
+	printf("layouts: %d cases, %d failures\n", tests, failures);
+
+	i = test_blend(WS2812_BLEND_OVER) + test_blend(WS2812_BLEND_ADD);
+	printf("blend: %d failures\n", i);
+	failures += i;
+
+	i = test_sum();
+	printf("sum: %d failures\n", i);
+	failures += i;
+
+	i = test_scale();
+	printf("scale: %d failures\n", i);
+	failures += i;
+
+	i = test_average();
+	printf("average: %d failures\n", i);
+	failures += i;
+
+	return failures ? 1 : 0;
+}
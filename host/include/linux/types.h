@@ -0,0 +1,23 @@
+/*
+ * Kernel types for host builds of the ws2812 encoders
+ */
+
+#ifndef _HOST_LINUX_TYPES_H
+#define _HOST_LINUX_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+typedef int32_t __s32;
+typedef int64_t __s64;
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Host benchmark for ws2812 frame sampling
+ *
+ * Averages the edge rectangles of an ambilight layout over 1080p and 4K
+ * XRGB8888 frames, the way WS2812_IOC_SAMPLE does, once with the NEON
+ * row sums and once with the scalar loop alone.  Off ARM the NEON kernel
+ * runs on emu/arm_neon.h, so only the scalar timings mean anything there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws2812.h"
+#include "ws2812-encode.h"
+
+// LEDs along the top and bottom, and down each side
+#define LEDS_ACROSS 64
+#define LEDS_DOWN 36
+#define NUM_LEDS (2 * LEDS_ACROSS + 2 * LEDS_DOWN)
+
+// Rectangles reach a tenth of the way into the frame
+#define DEPTH_DIV 10
+
+#define FRAMES 200
+
+static struct ws2812_sample_rect rects[NUM_LEDS];
+static uint32_t colours[NUM_LEDS];
+
+static void add_rect(int n, int x, int y, int width, int height, int stride)
+{
+	uint32_t area = width * height;
+
+	rects[n].offset = y * stride + x * 4;
+	rects[n].width = width;
+	rects[n].height = height;
+	rects[n].recip = ((1ULL << 53) + area - 1) / area;
+}
+
+static void layout(int width, int height)
+{
+	int stride = width * 4;
+	int w = width / LEDS_ACROSS, h = height / LEDS_DOWN;
+	int dw = width / DEPTH_DIV, dh = height / DEPTH_DIV;
+	int i, n = 0;
+
+	for(i = 0; i < LEDS_ACROSS; i++)
+		add_rect(n++, i * w, 0, w, dh, stride);
+	for(i = 0; i < LEDS_DOWN; i++)
+		add_rect(n++, width - dw, i * h, dw, h, stride);
+	for(i = LEDS_ACROSS - 1; i >= 0; i--)
+		add_rect(n++, i * w, height - dh, w, dh, stride);
+	for(i = LEDS_DOWN - 1; i >= 0; i--)
+		add_rect(n++, 0, i * h, dw, h, stride);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, int width, int height)
+{
+	uint32_t *frame = malloc((size_t) width * height * 4);
+	uint32_t check[NUM_LEDS];
+	uint64_t pixels = 0;
+	double start, secs;
+	int neon, f, i;
+
+	for(i = 0; i < width * height; i++)
+		frame[i] = (uint32_t) rand() << 16 ^ rand();
+
+	layout(width, height);
+	for(i = 0; i < NUM_LEDS; i++)
+		pixels += (uint32_t) rects[i].width * rects[i].height;
+
+	for(neon = 1; neon >= 0; neon--)
+	{
+		start = now();
+		for(f = 0; f < FRAMES; f++)
+			for(i = 0; i < NUM_LEDS; i++)
+				colours[i] = ws2812_average_rect((const uint8_t *) frame,
+				                                 width * 4, &rects[i], neon);
+		secs = (now() - start) / FRAMES;
+
+		if(neon)
+			memcpy(check, colours, sizeof(check));
+		else if(memcmp(check, colours, sizeof(check)))
+			printf("%s: NEON and scalar averages differ\n", name);
+
+		printf("%s %s: %d LEDs, %llu pixels, %.3f ms per frame, %.0f Mpixel/s\n",
+		       name, neon ? "neon  " : "scalar", NUM_LEDS,
+		       (unsigned long long) pixels, secs * 1e3, pixels / secs / 1e6);
+	}
+
+	free(frame);
+}
+
+int main(void)
+{
+	srand(2812);
+
+	bench("1080p", 1920, 1080);
+	bench("4K   ", 3840, 2160);
+
+	return 0;
+}
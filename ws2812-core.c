@@ -0,0 +1,3034 @@
+/*
+ * Raspberry Pi WS2812 PWM driver
+ *
+ * Written by: Gordon Hollingworth <gordon@fiveninjas.com>
+ * Based on DMA PWM driver from Jonathan Bell <jonathan@raspberrypi.org>
+ *
+ * Copyright (C) 2014 Raspberry Pi Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * To use this driver you need to make sure that the PWM clock is set to 2.4MHz
+ * and the correct PWM0 output is connected.  The best way to do this is to
+ * create a dt-blob.bin on your RaspberryPi, start by downloading the default
+ * dt-blob.dts from
+ *
+ * Note, this uses the same PWM hardware as the standard audio output on the Pi
+ * so you cannot use both simultaneously.
+ *
+ * http://www.raspberrypi.org/documentation/configuration/pin-configuration.md
+ *
+ * (Copy the bit from /dts-v1/; through to the end...  This will contain the pin
+ * configuration for all the Raspberry Pi versions (since they are different.
+ * You can get rid of the ones you don't care about.  Next alter the PWM0 output
+ * you want to use.
+ *
+ * http://www.raspberrypi.org/documentation/hardware/raspberrypi/bcm2835/BCM2835-ARM-Peripherals.pdf
+ *
+ * The link above will help understand what the GPIOs can do, check out page 102
+ * You can use: GPIO12, GPIO18 or GPIO40, so for the Slice board we use GPIO40 so
+ * we have the following in the dts file
+ *
+ * pin@p40 {
+ *  function = "pwm";
+ *  termination = "no_pulling";
+ * };
+ *
+ * And at the bottom of the dts file, although still in the 'videocore' block we
+ * have:
+ *
+ * clock_setup {
+ *  clock@PWM { freq = <2400000>; };
+ * };
+ *
+ * To check whether the changes are correct you can use 'vcgencmd measure_clock 25'
+ * This should return the value 2400000
+ *
+ * Also if you use wiringPi then you can do 'gpio readall' to check that the pin
+ * alternate setting is set correctly.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fcntl.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/wait.h>
+#include <linux/io.h>
+#include <linux/ioctl.h>
+#include <linux/cdev.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/slab.h>
+#include <linux/platform_device.h>
+#include <linux/uaccess.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/gpio/consumer.h>
+#include <linux/debugfs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/idr.h>
+#include <linux/clk.h>
+#include <linux/dma-buf.h>
+#include <linux/version.h>
+#include <asm-generic/ioctl.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#include <asm/simd.h>
+#endif
+
+#include "ws2812.h"
+#include "ws2812-encode.h"
+#include "ws2812-ioctl.h"
+
+#define DRIVER_NAME "ws2812"
+
+// Strips that can be driven at once, each gets /dev/ws2812-<n>
+#define WS2812_MAX_DEVICES 8
+
+// Char devices for all strips and their zones
+#define WS2812_MAX_MINORS 64
+
+// Encoded frames, one is encoded while the other is sent
+#define WS2812_NUM_BUFFERS 2
+
+// Pixel frames userspace can render into through mmap()
+#define WS2812_NUM_SLOTS 3
+
+// Fastest frame clock that can be set
+#define WS2812_MAX_REFRESH_HZ 1000
+
+// Frames that can wait for their target time by default and at most, and
+// the results kept per frame
+#define WS2812_QUEUE_DEPTH 8
+#define WS2812_MAX_QUEUE_DEPTH 256
+#define WS2812_STATUS_PER_FRAME 4
+
+// Default memory for pre-encoded frames, changed through sysfs
+#define WS2812_CACHE_LIMIT (256 * 1024)
+
+// PWM channels fed from the shared FIFO, one strip each
+#define WS2812_MAX_STRIPS 2
+
+/* Encoded output, allocated coherent at probe so frames need no mapping
+ * or cache maintenance.  pixels holds what the first valid LEDs of data
+ * were encoded from, encoded with lookup tables of generation lut_gen.
+ * With one strip LEDs are encoded straight into data, with two they are
+ * encoded back to back into encoded and interleaved word by word into data.
+ */
+struct ws2812_buffer {
+	uint8_t *              data;
+	dma_addr_t             dma_addr;
+	int                    length;
+	uint8_t *              encoded;
+
+	uint32_t *             pixels;
+	int                    valid;
+	u32                    lut_gen;
+
+	bool                   timed;
+};
+
+/* A frame waiting in the timed queue for its target time */
+struct ws2812_timed {
+	struct ws2812_buffer   buffer;
+	struct list_head       list;
+	ktime_t                target;
+	ktime_t                actual;
+	u32                    seq;
+	u64                    submit_seq;
+};
+
+/* A frame encoded once and sent again by handle, most recently used first
+ * on the cache list
+ */
+struct ws2812_cached {
+	struct ws2812_buffer   buffer;
+	struct list_head       list;
+	u32                    handle;
+	int                    num_leds;
+};
+
+/* An overlay layer, ARGB32 pixels for the whole strip */
+struct ws2812_overlay {
+	u32                    mode;
+	uint32_t *             pixels;
+};
+
+struct ws2812_state {
+	struct device *        dev;
+	struct cdev            cdev;
+	int                    id;
+	dev_t                  devt;
+	struct ws2812_zone *   zones;
+	int                    num_zones;
+	struct dma_chan *      dma_chan;
+
+	void __iomem *         ioaddr;
+	phys_addr_t            phys_addr;
+
+	/* active is on the wire, queued goes out when it completes or on the
+	 * next frame clock tick if frame_period is set, all protected by
+	 * dma_lock.  The sequence numbers belong to the submissions rather
+	 * than the buffers, a cached buffer can be sent again while it is
+	 * still active.
+	 */
+	spinlock_t             dma_lock;
+	struct ws2812_buffer   buffers[WS2812_NUM_BUFFERS];
+	struct ws2812_buffer * active;
+	struct ws2812_buffer * queued;
+	u64                    active_seq;
+	u64                    queued_seq;
+	struct hrtimer         frame_timer;
+	ktime_t                frame_period;
+	u32                    refresh_hz;
+
+	/* Timed frames, either on the free list, on the queue sorted by
+	 * target time or handed to the DMA, with the results of those sent
+	 * or dropped in status.  Protected by dma_lock.
+	 */
+	struct ws2812_timed *  timed;
+	u32                    queue_depth;
+	struct list_head       timed_free;
+	struct list_head       timed_queue;
+	struct hrtimer         queue_timer;
+	u32                    timed_seq;
+	struct ws2812_frame_status * status;
+	unsigned int           status_depth;
+	unsigned int           status_head;
+	unsigned int           status_count;
+
+	/* Woken whenever a frame completes or leaves the queue */
+	wait_queue_head_t      wait;
+	u64                    submit_seq;
+
+	uint32_t *             pixbuf;
+	/* The last frame shown and the overlays blended over it into
+	 * composite before it is encoded
+	 */
+	uint32_t *             base;
+	int                    base_len;
+	struct ws2812_overlay  layers[WS2812_LAYERS];
+	int                    layers_active;
+	uint32_t *             composite;
+	/* What write() has drawn, LEDs frame_first to frame_end have been
+	 * written since show_work last merged them into base.
+	 * Protected by frame_lock rather than lock so write() only waits for
+	 * other writers, show_work encodes and sends it on wq.
+	 */
+	struct mutex           frame_lock;
+	uint32_t *             frame;
+	int                    frame_first;
+	int                    frame_end;
+	/* Pixels written in a compact format, unpacked into frame */
+	uint8_t *              inbuf;
+	struct workqueue_struct * wq;
+	struct work_struct     show_work;
+	u64                    show_seq;
+
+	/* Effect rendered into pixbuf by effect_work, kicked off by
+	 * effect_timer, effect is protected by lock
+	 */
+	struct ws2812_effect   effect;
+	ktime_t                effect_start;
+	ktime_t                effect_interval;
+	struct hrtimer         effect_timer;
+	struct work_struct     effect_work;
+
+	/* Pre-encoded frames, cache_size bytes of at most cache_limit */
+	struct list_head       cache;
+	size_t                 cache_size;
+	size_t                 cache_limit;
+	u32                    cache_handle;
+
+	/* dma-buf imported for ambilight sampling through sample_file,
+	 * mapped at sample_vaddr, LED n is the average of sample_rects[n]
+	 */
+	struct dma_buf *       sample_buf;
+	struct ws2812_file *   sample_file;
+	void *                 sample_vaddr;
+	struct ws2812_sample_rect * sample_rects;
+	u32                    sample_leds;
+	u32                    sample_stride;
+
+	/* mmap()able pixel frames, next is handed out by the commit ioctl */
+	void *                 slots;
+	u32                    slot_size;
+	u32                    next_slot;
+
+	struct dentry *        debugfs;
+	u64                    frames;
+	u64                    sync_bytes_saved;
+	u64                    frames_dropped;
+	u64                    leds_encoded;
+	u32                    last_leds_encoded;
+	u64                    cache_hits;
+	u64                    cache_misses;
+
+	struct gpio_desc *     led_en;
+
+	struct mutex           lock;
+	unsigned char          brightness;
+	uint8_t                lut[WS2812_MAX_CHANNELS][256];
+	u32                    lut_gen;
+	u32                    invert;
+	u32                    num_leds;
+
+	/* num_leds is the length of all strips together, strip 0 first */
+	u32                    strip_leds[WS2812_MAX_STRIPS];
+	int                    num_strips;
+	int                    strip_max;
+
+	/* Encoding, strip s is encoded from strip_offset[s] of encoded and
+	 * every strip is followed by reset_bytes of low in the DMA data
+	 */
+	const struct ws2812_layout * layout;
+	u32                    symbols;
+	struct clk *           clk;
+	unsigned long          symbol_rate;
+	int                    bytes_per_led;
+	int                    reset_bytes;
+	int                    strip_offset[WS2812_MAX_STRIPS];
+	size_t                 encoded_size;
+	size_t                 buffer_size;
+};
+
+/* A range of the strip with its own char device, writes to it only
+ * update the LEDs from first on
+ */
+struct ws2812_zone {
+	struct ws2812_state *  state;
+	struct cdev            cdev;
+	dev_t                  devt;
+	u32                    first;
+	u32                    num_leds;
+};
+
+/* Per open file, seq is the last frame submitted through it, protected by
+ * lock.  written is set while a write() may not have been submitted yet.
+ * Pixels are written in format, palette is used for WS2812_FORMAT_PAL8,
+ * these three are protected by frame_lock.  write() reaches num_leds LEDs
+ * from first, the whole strip unless the file is a zone.
+ */
+struct ws2812_file {
+	struct ws2812_state *  state;
+	struct ws2812_zone *   zone;
+	u32                    first;
+	u32                    num_leds;
+	u64                    seq;
+	bool                   written;
+	u32                    format;
+	uint32_t               palette[WS2812_PALETTE_SIZE];
+};
+
+#ifndef BCM2708_PERI_BASE
+ #define BCM2708_PERI_BASE 0x20000000
+#endif
+
+#define BCM2835_VCMMU_SHIFT		(0x7E000000 - BCM2708_PERI_BASE)
+
+// PWM clock the board is set up with, see the top of this file
+#define WS2812_PWM_CLOCK 2400000
+
+// Low time needed to create a reset condition
+#define RESET_US 50
+
+#define PWM_CTL 0x0
+#define PWM_STA 0x4
+#define PWM_DMAC 0x8
+#define PWM_RNG1 0x10
+#define PWM_DAT1 0x14
+#define PWM_FIFO1 0x18
+#define PWM_RNG2 0x20
+#define PWM_DAT2 0x24
+#define PWM_ID 0x50
+
+#define PWM_DMA_DREQ 5
+
+static dev_t ws2812_devt;
+static struct class *ws2812_class;
+static DEFINE_IDA(ws2812_ida);
+static DEFINE_IDA(ws2812_minors);
+
+/*
+** Functions to access the pwm peripheral
+*/
+static void pwm_writel(struct ws2812_state * state, uint32_t val, uint32_t reg)
+{
+	writel(val, state->ioaddr + reg);
+}
+
+#if 0
+static uint32_t pwm_readl(struct ws2812_state * state, uint32_t reg)
+{
+	return readl(state->ioaddr + reg);
+}
+#endif
+
+/* Initialise the PWM module to use serial output
+ * mode
+ */
+static int pwm_init(struct ws2812_state * state)
+{
+	uint32_t reg;
+
+	// serial 32 bits per word
+	pwm_writel(state, 32, PWM_RNG1);
+	// Clear
+	pwm_writel(state, 0,  PWM_DAT1);
+
+	reg = (1 << 0) | /* CH1EN */
+	      (1 << 1) | /* serialiser */
+	      (0 << 2) | /* don't repeat last word */
+	      (0 << 3) | /* silence is zero */
+	      ((state->invert ? 1 : 0) << 4) | /* polarity */
+	      (1 << 5) | /* use fifo */
+	      (1 << 6) | /* Clear fifo */
+	      (1 << 7) | /* MSEN - Mask space enable */
+	      ((state->invert ? 1 : 0) << 11); /* Silence bit = 1 */
+
+	/* The second strip takes every other word from the FIFO */
+	if(state->num_strips > 1)
+	{
+		pwm_writel(state, 32, PWM_RNG2);
+		pwm_writel(state, 0,  PWM_DAT2);
+
+		reg |= (1 << 8) |  /* CH2EN */
+		       (1 << 9) |  /* serialiser */
+		       ((state->invert ? 1 : 0) << 12) | /* polarity */
+		       (1 << 13) | /* use fifo */
+		       (1 << 15);  /* MSEN2 */
+	}
+	pwm_writel(state, reg, PWM_CTL);
+	reg = (1 << 31) | /* DMA enabled */
+	      (4 << 8)  | /* Threshold for panic */
+	      (8 << 0);   /* Threshold for dreq */
+	pwm_writel(state, reg, PWM_DMAC);
+
+	return 0;
+
+}
+
+int issue_dma(struct ws2812_state * state, struct ws2812_buffer *buffer);
+
+/*
+ * A timed frame has been sent or dropped, record the result and return it
+ * to the free list.  Called with dma_lock held.
+ */
+static void ws2812_timed_done(struct ws2812_state * state,
+                              struct ws2812_buffer * buffer, bool dropped)
+{
+	struct ws2812_timed * timed = container_of(buffer, struct ws2812_timed, buffer);
+	struct ws2812_frame_status * status;
+
+	/* Overwrite the oldest result if nobody has collected them */
+	status = &state->status[(state->status_head + state->status_count) %
+	                        state->status_depth];
+	if(state->status_count < state->status_depth)
+		state->status_count++;
+	else
+		state->status_head = (state->status_head + 1) % state->status_depth;
+
+	status->seq = timed->seq;
+	status->flags = dropped ? WS2812_FRAME_DROPPED : 0;
+	status->target_ns = ktime_to_ns(timed->target);
+	status->actual_ns = dropped ? 0 : ktime_to_ns(timed->actual);
+
+	list_add_tail(&timed->list, &state->timed_free);
+}
+
+/*
+ * Make buffer the next frame to send, dropping any frame that has not
+ * started yet.  Called with dma_lock held.
+ */
+static void ws2812_queue(struct ws2812_state * state, struct ws2812_buffer * buffer,
+                         u64 seq)
+{
+	if(state->queued)
+	{
+		state->frames_dropped++;
+		if(state->queued->timed)
+			ws2812_timed_done(state, state->queued, true);
+	}
+	state->queued = buffer;
+	state->queued_seq = seq;
+}
+
+/*
+ * Start the queued frame if the DMA is idle, called with dma_lock held
+ */
+static void ws2812_kick(struct ws2812_state * state)
+{
+	struct ws2812_buffer * buffer = state->queued;
+	struct ws2812_timed * timed;
+
+	if(state->active || buffer == NULL)
+		return;
+
+	state->queued = NULL;
+	if(buffer->timed)
+	{
+		timed = container_of(buffer, struct ws2812_timed, buffer);
+		timed->actual = ktime_get();
+	}
+
+	if(issue_dma(state, buffer) == 0)
+	{
+		state->active = buffer;
+		state->active_seq = state->queued_seq;
+	}
+	else if(buffer->timed)
+		ws2812_timed_done(state, buffer, true);
+}
+
+/*
+ * DMA callback function, start the next frame if one was queued while this
+ * one was being sent and frames are not paced by the frame clock.  Timed
+ * frames are past their target already so always go straight out.
+ */
+void ws2812_callback(void * param)
+{
+	struct ws2812_state * state = (struct ws2812_state *) param;
+	struct ws2812_buffer * buffer;
+	unsigned long flags;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	buffer = state->active;
+	state->active = NULL;
+	if(buffer->timed)
+		ws2812_timed_done(state, buffer, false);
+
+	if(!state->frame_period || (state->queued && state->queued->timed))
+		ws2812_kick(state);
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	wake_up_interruptible(&state->wait);
+}
+
+/*
+ * Timed queue deadline, hand every frame whose target has passed to the
+ * DMA, only the newest of them is actually sent.  The timer is always
+ * (re)started with dma_lock held so it never races with
+ * ws2812_queue_frame().
+ */
+static enum hrtimer_restart ws2812_queue_tick(struct hrtimer *timer)
+{
+	struct ws2812_state * state = container_of(timer, struct ws2812_state, queue_timer);
+	struct ws2812_timed * timed;
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	now = ktime_get();
+	while(!list_empty(&state->timed_queue))
+	{
+		timed = list_first_entry(&state->timed_queue, struct ws2812_timed, list);
+		if(ktime_after(timed->target, now))
+		{
+			hrtimer_start(timer, timed->target, HRTIMER_MODE_ABS);
+			break;
+		}
+
+		list_del(&timed->list);
+		ws2812_queue(state, &timed->buffer, timed->submit_seq);
+	}
+	ws2812_kick(state);
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	wake_up_interruptible(&state->wait);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Frame clock tick, send the newest frame submitted since the last tick
+ */
+static enum hrtimer_restart ws2812_frame_tick(struct hrtimer *timer)
+{
+	struct ws2812_state * state = container_of(timer, struct ws2812_state, frame_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	ws2812_kick(state);
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	wake_up_interruptible(&state->wait);
+
+	hrtimer_forward_now(timer, state->frame_period);
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Set the frame clock, 0 sends each frame as soon as the DMA is free.
+ * Called with state->lock held.
+ */
+static int ws2812_set_refresh(struct ws2812_state * state, u32 hz)
+{
+	unsigned long flags;
+
+	if(hz > WS2812_MAX_REFRESH_HZ)
+		return -EINVAL;
+
+	hrtimer_cancel(&state->frame_timer);
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	state->refresh_hz = hz;
+	state->frame_period = hz ? ns_to_ktime(NSEC_PER_SEC / hz) : 0;
+	if(!hz)
+		ws2812_kick(state);
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	if(hz)
+		hrtimer_start(&state->frame_timer, state->frame_period,
+		              HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+/*
+ * Issue a DMA to the PWM peripheral from the assigned buffer, called with
+ * dma_lock held
+ */
+int issue_dma(struct ws2812_state * state, struct ws2812_buffer *buffer)
+{
+	struct dma_async_tx_descriptor *desc;
+
+	desc = dmaengine_prep_slave_single(state->dma_chan, buffer->dma_addr,
+		buffer->length, DMA_MEM_TO_DEV, DMA_PREP_INTERRUPT);
+	if(desc == NULL)
+	{
+		pr_err("Failed to prep the DMA transfer\n");
+		return -1;
+	}
+
+	desc->callback = ws2812_callback;
+	desc->callback_param = state;
+	dmaengine_submit(desc);
+	dma_async_issue_pending(state->dma_chan);
+
+	/* Each of these used to be mapped and unmapped for the transfer */
+	state->frames++;
+	state->sync_bytes_saved += buffer->length;
+
+	return 0;
+}
+
+/*
+ * Get a buffer to encode the next frame into, never the one being sent.
+ * If every other buffer is queued the oldest queued frame is dropped in
+ * favour of the new one.  Called with state->lock held so only one frame
+ * is encoded at a time.
+ */
+static struct ws2812_buffer * ws2812_get_buffer(struct ws2812_state * state)
+{
+	struct ws2812_buffer * buffer = NULL;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	for(i = 0; i < WS2812_NUM_BUFFERS; i++)
+	{
+		if(&state->buffers[i] != state->active &&
+		   &state->buffers[i] != state->queued)
+		{
+			buffer = &state->buffers[i];
+			break;
+		}
+	}
+
+	if(buffer == NULL)
+	{
+		buffer = state->queued;
+		state->queued = NULL;
+		state->frames_dropped++;
+	}
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return buffer;
+}
+
+/*
+ * Queue an encoded buffer, replacing any frame that has not started yet.
+ * Without a frame clock it is sent now if the DMA is idle, otherwise as
+ * soon as the current frame completes.  Called with state->lock held,
+ * returns the sequence number of the frame.
+ */
+static u64 ws2812_submit(struct ws2812_state * state, struct ws2812_buffer * buffer)
+{
+	unsigned long flags;
+	u64 seq = ++state->submit_seq;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	ws2812_queue(state, buffer, seq);
+	if(!state->frame_period)
+		ws2812_kick(state);
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return seq;
+}
+
+/*
+ * Check whether every frame up to seq has been sent or dropped
+ */
+static bool ws2812_frame_done(struct ws2812_state * state, u64 seq)
+{
+	struct ws2812_timed * timed;
+	unsigned long flags;
+	bool done = true;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	if(state->active && state->active_seq <= seq)
+		done = false;
+	if(state->queued && state->queued_seq <= seq)
+		done = false;
+	list_for_each_entry(timed, &state->timed_queue, list)
+	{
+		if(timed->submit_seq <= seq)
+			done = false;
+	}
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return done;
+}
+
+
+static int ws2812_open(struct inode *inode, struct file *file)
+{
+	struct ws2812_state * state;
+	struct ws2812_file * wfile;
+	state  = container_of(inode->i_cdev, struct ws2812_state, cdev);
+
+	wfile = kzalloc(sizeof(struct ws2812_file), GFP_KERNEL);
+	if(wfile == NULL)
+		return -ENOMEM;
+
+	wfile->state = state;
+	wfile->num_leds = state->num_leds;
+	file->private_data = wfile;
+	file->f_mode |= FMODE_NOWAIT;
+
+	return 0;
+}
+
+static int ws2812_zone_open(struct inode *inode, struct file *file)
+{
+	struct ws2812_zone * zone;
+	struct ws2812_file * wfile;
+	zone = container_of(inode->i_cdev, struct ws2812_zone, cdev);
+
+	wfile = kzalloc(sizeof(struct ws2812_file), GFP_KERNEL);
+	if(wfile == NULL)
+		return -ENOMEM;
+
+	wfile->state = zone->state;
+	wfile->zone = zone;
+	wfile->first = zone->first;
+	wfile->num_leds = zone->num_leds;
+	file->private_data = wfile;
+	file->f_mode |= FMODE_NOWAIT;
+
+	return 0;
+}
+
+/* WS2812B gamma correction
+GammaE=255*(res/255).^(1/.45)
+From: http://rgb-123.com/ws2812-color-output/
+*/
+static const unsigned char GammaE[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2,
+	2, 2, 2, 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5,
+	6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 11, 11,
+	11, 12, 12, 13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18,
+	19, 19, 20, 21, 21, 22, 22, 23, 23, 24, 25, 25, 26, 27, 27, 28,
+	29, 29, 30, 31, 31, 32, 33, 34, 34, 35, 36, 37, 37, 38, 39, 40,
+	40, 41, 42, 43, 44, 45, 46, 46, 47, 48, 49, 50, 51, 52, 53, 54,
+	55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70,
+	71, 72, 73, 74, 76, 77, 78, 79, 80, 81, 83, 84, 85, 86, 88, 89,
+	90, 91, 93, 94, 95, 96, 98, 99,100,102,103,104,106,107,109,110,
+	111,113,114,116,117,119,120,121,123,124,126,128,129,131,132,134,
+	135,137,138,140,142,143,145,146,148,150,151,153,155,157,158,160,
+	162,163,165,167,169,170,172,174,176,178,179,181,183,185,187,189,
+	191,193,194,196,198,200,202,204,206,208,210,212,214,216,218,220,
+	222,224,227,229,231,233,235,237,239,241,244,246,248,250,252,255};
+
+/*
+ * Rebuild the per channel lookup tables, each entry is the gamma corrected
+ * output for an input value with the brightness already applied.  Must be
+ * called whenever the brightness changes.
+ */
+static void ws2812_update_lut(struct ws2812_state * state)
+{
+	int c, val;
+
+	for(c = 0; c < WS2812_MAX_CHANNELS; c++)
+		for(val = 0; val < 256; val++)
+			state->lut[c][val] = GammaE[(val * state->brightness) / 255];
+
+	/* Everything encoded so far used the old tables */
+	state->lut_gen++;
+}
+
+static const struct ws2812_layout * ws2812_find_layout(const char *order)
+{
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(ws2812_layouts); i++)
+		if(strcmp(ws2812_layouts[i].order, order) == 0)
+			return &ws2812_layouts[i];
+
+	return NULL;
+}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+static bool ws2812_can_use_neon(void)
+{
+#ifdef CONFIG_ARM
+	if(!cpu_has_neon())
+		return false;
+#endif
+	return may_use_simd();
+}
+#endif
+
+/*
+ * Encode count RGB32 pixels as LEDs led onwards of the strip encoded at
+ * base, using the NEON batch encoder where the CPU has one and the
+ * encoder for the pixel layout for the rest.
+ */
+static void ws2812_encode(struct ws2812_state * state, const uint32_t *pixels,
+                          unsigned char *base, int led, int count)
+{
+	const struct ws2812_layout *layout = state->layout;
+	unsigned char *buf = base + led * state->bytes_per_led;
+
+	if(state->symbols == 3)
+	{
+		layout->encode3(state->lut, pixels, base, led, count);
+		return;
+	}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if(count >= WS2812_NEON_BATCH && ws2812_can_use_neon())
+	{
+		int done;
+
+		kernel_neon_begin();
+		done = ws2812_encode_neon(state->lut, layout->shift, layout->channels,
+		                          pixels, (uint32_t *) buf, count);
+		kernel_neon_end();
+
+		pixels += done;
+		buf += done * state->bytes_per_led;
+		count -= done;
+	}
+#endif
+	layout->encode(state->lut, pixels, buf, count);
+}
+
+/*
+ * Encode LEDs start to end, which may span both strips, into the encoded
+ * data of buffer and copy the words they touch into their place in the DMA
+ * data.  With two strips each takes every other word of the DMA data.
+ */
+static void ws2812_encode_range(struct ws2812_state * state,
+                                struct ws2812_buffer * buffer,
+                                const uint32_t *pixels, int start, int end)
+{
+	const uint32_t *src;
+	uint32_t *dst = (uint32_t *) buffer->data;
+	int s, i, from, to, first = 0;
+
+	for(s = 0; s < state->num_strips; first += state->strip_leds[s++])
+	{
+		from = max(start, first) - first;
+		to = min_t(int, end, first + state->strip_leds[s]) - first;
+		if(from >= to)
+			continue;
+
+		ws2812_encode(state, pixels + first + from,
+		              buffer->encoded + state->strip_offset[s], from, to - from);
+
+		/* A single strip is encoded in place */
+		if(state->num_strips == 1)
+			continue;
+
+		/* Words shared with a neighbouring LED hold its current encoding */
+		src = (const uint32_t *) (buffer->encoded + state->strip_offset[s]);
+		for(i = from * state->bytes_per_led / 4;
+		    i < DIV_ROUND_UP(to * state->bytes_per_led, 4); i++)
+			dst[i * state->num_strips + s] = src[i];
+	}
+}
+
+/*
+ * Terminate a frame of num_leds encoded LEDs with the reset and set the
+ * length to send.  This overwrites the start of any LEDs beyond num_leds,
+ * they are no longer valid.  With two strips the shorter strip and any
+ * LEDs not written are held low until the longer one is done.
+ */
+static void ws2812_fill_reset(struct ws2812_state * state,
+                              struct ws2812_buffer * buffer, int num_leds)
+{
+	uint32_t *dst = (uint32_t *) buffer->data;
+	unsigned char *enc;
+	int s, i, end, words, first = 0;
+
+	words = (state->buffer_size / 4) / state->num_strips;
+
+	for(s = 0; s < state->num_strips; first += state->strip_leds[s++])
+	{
+		enc = buffer->encoded + state->strip_offset[s];
+		end = clamp_t(int, num_leds - first, 0, state->strip_leds[s]) *
+		      state->bytes_per_led;
+
+		/* Clear the rest of the word the last LED ends in */
+		for(i = end; i & 3; i++)
+			enc[i ^ 3] = 0;
+
+		if(state->num_strips == 1)
+		{
+			memset(enc + i, 0x00, state->reset_bytes);
+			buffer->length = i + state->reset_bytes;
+			return;
+		}
+
+		i = end / 4;
+		if(end & 3)
+		{
+			dst[i * state->num_strips + s] = ((uint32_t *) enc)[i];
+			i++;
+		}
+		for(; i < words; i++)
+			dst[i * state->num_strips + s] = 0;
+	}
+
+	buffer->length = state->buffer_size;
+}
+
+
+/*
+ * Bring the encoded data of a buffer up to date with pixels, only LEDs that
+ * differ from what the buffer was last encoded from are encoded again.
+ */
+static void ws2812_encode_dirty(struct ws2812_state * state,
+                                struct ws2812_buffer * buffer,
+                                const uint32_t *pixels, int num_leds)
+{
+	int i = 0, start, valid, encoded = 0;
+
+	if(buffer->lut_gen != state->lut_gen)
+		buffer->valid = 0;
+	valid = min(buffer->valid, num_leds);
+
+	while(i < valid)
+	{
+		if(buffer->pixels[i] == pixels[i])
+		{
+			i++;
+			continue;
+		}
+
+		start = i;
+		while(i < valid && buffer->pixels[i] != pixels[i])
+			i++;
+
+		ws2812_encode_range(state, buffer, pixels, start, i);
+		encoded += i - start;
+	}
+
+	/* Anything beyond what the buffer holds is encoded in full */
+	ws2812_encode_range(state, buffer, pixels, valid, num_leds);
+	encoded += num_leds - valid;
+
+	if(buffer->pixels != pixels)
+		memcpy(buffer->pixels, pixels, num_leds * sizeof(uint32_t));
+	buffer->valid = num_leds;
+	buffer->lut_gen = state->lut_gen;
+
+	state->leds_encoded += encoded;
+	state->last_leds_encoded = encoded;
+}
+
+/*
+ * Blend count pixels of a layer, with NEON where the CPU has it and the
+ * scalar blend for the rest
+ */
+static void ws2812_blend_layer(uint32_t *dst, const uint32_t *src, u32 mode,
+                               int count)
+{
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if(count >= WS2812_NEON_BATCH && ws2812_can_use_neon())
+	{
+		int done;
+
+		kernel_neon_begin();
+		done = ws2812_blend_neon(dst, src, mode, count);
+		kernel_neon_end();
+
+		dst += done;
+		src += done;
+		count -= done;
+	}
+#endif
+	ws2812_blend_scalar(dst, src, mode, count);
+}
+
+/*
+ * Encode num_leds pixels into buffer followed by the reset, with any
+ * overlay layers blended over them first
+ */
+static void ws2812_fill(struct ws2812_state * state, struct ws2812_buffer * buffer,
+                        const uint32_t *pixels, int num_leds)
+{
+	int l;
+
+	if(state->layers_active)
+	{
+		memcpy(state->composite, pixels, num_leds * sizeof(uint32_t));
+		for(l = 0; l < WS2812_LAYERS; l++)
+			if(state->layers[l].mode != WS2812_BLEND_OFF)
+				ws2812_blend_layer(state->composite,
+				                   state->layers[l].pixels,
+				                   state->layers[l].mode, num_leds);
+		pixels = state->composite;
+	}
+
+	ws2812_encode_dirty(state, buffer, pixels, num_leds);
+	ws2812_fill_reset(state, buffer, num_leds);
+}
+
+/*
+ * Encode num_leds pixels into a free buffer and send them, called with
+ * state->lock held.  Returns the sequence number of the frame.
+ */
+static u64 ws2812_show(struct ws2812_state * state, const uint32_t *pixels,
+                       int num_leds)
+{
+	struct ws2812_buffer * buffer;
+
+	/* Kept to blend again when a layer changes */
+	if(pixels != state->base)
+		memcpy(state->base, pixels, num_leds * sizeof(uint32_t));
+	state->base_len = num_leds;
+
+	buffer = ws2812_get_buffer(state);
+	ws2812_fill(state, buffer, pixels, num_leds);
+
+	/* Setup DMA engine, sent once the previous frame completes */
+	return ws2812_submit(state, buffer);
+}
+
+/*
+ * Change an overlay layer and show the last frame again with it, called
+ * with state->lock held
+ */
+static int ws2812_set_layer(struct ws2812_state * state,
+                            const struct ws2812_layer * layer)
+{
+	struct ws2812_overlay * overlay;
+
+	if(layer->layer >= WS2812_LAYERS || layer->mode > WS2812_BLEND_ADD)
+		return -EINVAL;
+	if(layer->first > state->num_leds ||
+	   layer->num_leds > state->num_leds - layer->first)
+		return -EINVAL;
+
+	overlay = &state->layers[layer->layer];
+	if(layer->mode == WS2812_BLEND_OFF)
+	{
+		if(overlay->mode != WS2812_BLEND_OFF)
+			state->layers_active--;
+		overlay->mode = WS2812_BLEND_OFF;
+		kfree(overlay->pixels);
+		overlay->pixels = NULL;
+	}
+	else
+	{
+		if(overlay->pixels == NULL)
+		{
+			overlay->pixels = kcalloc(state->num_leds, sizeof(uint32_t),
+			                          GFP_KERNEL);
+			if(overlay->pixels == NULL)
+				return -ENOMEM;
+		}
+
+		if(copy_from_user(overlay->pixels + layer->first,
+		                  u64_to_user_ptr(layer->pixels),
+		                  layer->num_leds * sizeof(uint32_t)))
+			return -EFAULT;
+
+		if(overlay->mode == WS2812_BLEND_OFF)
+			state->layers_active++;
+		overlay->mode = layer->mode;
+	}
+
+	ws2812_show(state, state->base, state->base_len);
+
+	return 0;
+}
+
+int clear_leds(struct ws2812_state * state)
+{
+	mutex_lock(&state->lock);
+
+	memset(state->pixbuf, 0, state->num_leds * sizeof(uint32_t));
+	ws2812_show(state, state->pixbuf, state->num_leds);
+
+	mutex_unlock(&state->lock);
+
+	return 0;
+}
+
+#define WS2812_RGB(r, g, b) (((r) << 16) | ((g) << 8) | (b))
+
+/*
+ * Mix two RGB32 colours, frac from 0 (all a) to 256 (all b)
+ */
+static uint32_t ws2812_blend(uint32_t a, uint32_t b, unsigned int frac)
+{
+	uint32_t out = 0;
+	int shift;
+
+	for(shift = 0; shift < 24; shift += 8)
+	{
+		uint32_t ca = (a >> shift) & 0xff;
+		uint32_t cb = (b >> shift) & 0xff;
+
+		out |= ((ca * (256 - frac) + cb * frac) >> 8) << shift;
+	}
+
+	return out;
+}
+
+/*
+ * Fully saturated colour for a hue from 0 to 6 * 256 - 1
+ */
+static uint32_t ws2812_hue(unsigned int hue)
+{
+	unsigned int x = hue & 0xff;
+
+	switch(hue >> 8)
+	{
+		case 0: return WS2812_RGB(255, x, 0);
+		case 1: return WS2812_RGB(255 - x, 255, 0);
+		case 2: return WS2812_RGB(0, 255, x);
+		case 3: return WS2812_RGB(0, 255 - x, 255);
+		case 4: return WS2812_RGB(x, 0, 255);
+		default: return WS2812_RGB(255, 0, 255 - x);
+	}
+}
+
+/*
+ * Render the effect at phase, the position within its period from 0 to
+ * 65535
+ */
+static void ws2812_effect_render(struct ws2812_state * state, uint32_t *pixels,
+                                 u32 phase)
+{
+	const struct ws2812_effect * effect = &state->effect;
+	u32 n = effect->num_colours;
+	u32 i, pos, colour;
+
+	switch(effect->type)
+	{
+		case WS2812_EFFECT_FADE:
+			pos = phase * n;
+			colour = ws2812_blend(effect->palette[pos >> 16],
+			                      effect->palette[((pos >> 16) + 1) % n],
+			                      (pos >> 8) & 0xff);
+			for(i = 0; i < state->num_leds; i++)
+				pixels[i] = colour;
+			break;
+		case WS2812_EFFECT_CHASE:
+			pos = (phase * n) >> 16;
+			for(i = 0; i < state->num_leds; i++)
+				pixels[i] = effect->palette[(i + n - pos) % n];
+			break;
+		case WS2812_EFFECT_RAINBOW:
+			pos = (phase * 6 * 256) >> 16;
+			for(i = 0; i < state->num_leds; i++)
+				pixels[i] = ws2812_hue((i * 6 * 256 / state->num_leds + pos) %
+				                       (6 * 256));
+			break;
+	}
+}
+
+/*
+ * Render and send the next effect frame, unless a frame from userspace has
+ * stopped the effect since the timer fired
+ */
+static void ws2812_effect_work(struct work_struct *work)
+{
+	struct ws2812_state * state = container_of(work, struct ws2812_state, effect_work);
+	u64 period, elapsed, rem;
+
+	mutex_lock(&state->lock);
+
+	if(state->effect.type != WS2812_EFFECT_NONE)
+	{
+		period = (u64) state->effect.period_ms * NSEC_PER_MSEC;
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), state->effect_start));
+		div64_u64_rem(elapsed, period, &rem);
+
+		ws2812_effect_render(state, state->pixbuf,
+		                     div64_u64(rem << 16, period));
+		ws2812_show(state, state->pixbuf, state->num_leds);
+	}
+
+	mutex_unlock(&state->lock);
+}
+
+static enum hrtimer_restart ws2812_effect_tick(struct hrtimer *timer)
+{
+	struct ws2812_state * state = container_of(timer, struct ws2812_state, effect_timer);
+
+	queue_work(state->wq, &state->effect_work);
+	hrtimer_forward_now(timer, state->effect_interval);
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Stop any effect, called with state->lock held whenever a frame arrives
+ * from userspace.  A frame already being rendered sees the effect has gone
+ * once it gets the lock.
+ */
+static void ws2812_stop_effect(struct ws2812_state * state)
+{
+	if(state->effect.type == WS2812_EFFECT_NONE)
+		return;
+
+	state->effect.type = WS2812_EFFECT_NONE;
+	hrtimer_cancel(&state->effect_timer);
+}
+
+/*
+ * Start an effect, called with state->lock held
+ */
+static int ws2812_set_effect(struct ws2812_state * state,
+                             const struct ws2812_effect * effect)
+{
+	switch(effect->type)
+	{
+		case WS2812_EFFECT_NONE:
+			ws2812_stop_effect(state);
+			return 0;
+		case WS2812_EFFECT_FADE:
+		case WS2812_EFFECT_CHASE:
+			if(effect->num_colours == 0 ||
+			   effect->num_colours > WS2812_EFFECT_COLOURS)
+				return -EINVAL;
+			break;
+		case WS2812_EFFECT_RAINBOW:
+			break;
+		default:
+			return -EINVAL;
+	}
+
+	/* The phase is worked out as rem << 16 / period in 64 bits, the
+	 * period limit keeps that from overflowing
+	 */
+	if(effect->period_ms == 0 || effect->period_ms > WS2812_EFFECT_MAX_PERIOD_MS ||
+	   effect->fps == 0 || effect->fps > WS2812_MAX_REFRESH_HZ)
+		return -EINVAL;
+
+	ws2812_stop_effect(state);
+
+	state->effect = *effect;
+	state->effect_start = ktime_get();
+	state->effect_interval = ns_to_ktime(NSEC_PER_SEC / effect->fps);
+	hrtimer_start(&state->effect_timer, 0, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static int ws2812_alloc_buffer(struct ws2812_state * state,
+                               struct ws2812_buffer * buffer)
+{
+	buffer->data = dma_alloc_coherent(state->dev, state->buffer_size,
+	                                  &buffer->dma_addr, GFP_KERNEL);
+	if(buffer->data == NULL)
+		return -ENOMEM;
+
+	buffer->encoded = buffer->data;
+	if(state->num_strips > 1)
+	{
+		buffer->encoded = kmalloc(state->encoded_size, GFP_KERNEL);
+		if(buffer->encoded == NULL)
+			goto fail_encoded;
+	}
+
+	buffer->pixels = kmalloc(state->num_leds * sizeof(uint32_t), GFP_KERNEL);
+	if(buffer->pixels == NULL)
+		goto fail_pixels;
+
+	buffer->valid = 0;
+
+	return 0;
+fail_pixels:
+	if(buffer->encoded != buffer->data)
+		kfree(buffer->encoded);
+fail_encoded:
+	dma_free_coherent(state->dev, state->buffer_size,
+	                  buffer->data, buffer->dma_addr);
+	buffer->data = NULL;
+	return -ENOMEM;
+}
+
+static void ws2812_free_buffer(struct ws2812_state * state,
+                               struct ws2812_buffer * buffer)
+{
+	if(buffer->data == NULL)
+		return;
+
+	if(buffer->encoded != buffer->data)
+		kfree(buffer->encoded);
+	dma_free_coherent(state->dev, state->buffer_size,
+	                  buffer->data, buffer->dma_addr);
+	kfree(buffer->pixels);
+	buffer->data = NULL;
+}
+
+/*
+ * Encode a frame now and queue it to be sent at its CLOCK_MONOTONIC target
+ * time.  The DMA buffers of the timed queue are allocated on first use.
+ * Called with state->lock held.
+ */
+static int ws2812_queue_frame(struct ws2812_state * state,
+                              struct ws2812_timed_frame * frame, u64 *seq)
+{
+	struct ws2812_timed * timed, * pos;
+	unsigned long flags;
+	int ret;
+
+	if(frame->num_leds == 0 || frame->num_leds > state->num_leds)
+		return -EINVAL;
+
+	ws2812_stop_effect(state);
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	timed = list_first_entry_or_null(&state->timed_free, struct ws2812_timed, list);
+	if(timed)
+		list_del(&timed->list);
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	if(timed == NULL)
+		return -EAGAIN;
+
+	if(timed->buffer.data == NULL)
+	{
+		ret = ws2812_alloc_buffer(state, &timed->buffer);
+		if(ret)
+			goto fail;
+		timed->buffer.timed = true;
+	}
+
+	if(copy_from_user(state->pixbuf, u64_to_user_ptr(frame->pixels),
+	                  frame->num_leds * sizeof(uint32_t)))
+	{
+		ret = -EFAULT;
+		goto fail;
+	}
+
+	ws2812_fill(state, &timed->buffer, state->pixbuf, frame->num_leds);
+	timed->target = ns_to_ktime(frame->target_ns);
+	timed->seq = frame->seq = ++state->timed_seq;
+	timed->submit_seq = ++state->submit_seq;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+
+	/* Keep the queue sorted, frames with the same target go out in the
+	 * order they were queued
+	 */
+	list_for_each_entry_reverse(pos, &state->timed_queue, list)
+	{
+		if(!ktime_before(timed->target, pos->target))
+			break;
+	}
+	list_add(&timed->list, &pos->list);
+
+	if(state->timed_queue.next == &timed->list)
+		hrtimer_start(&state->queue_timer, timed->target, HRTIMER_MODE_ABS);
+
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	*seq = timed->submit_seq;
+
+	return 0;
+fail:
+	spin_lock_irqsave(&state->dma_lock, flags);
+	list_add(&timed->list, &state->timed_free);
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return ret;
+}
+
+/*
+ * Queue the frames of a batch for their targets until the timed queue is
+ * full or a frame fails, each frame is encoded as it is queued.  Called
+ * with state->lock held.
+ */
+static int ws2812_queue_batch(struct ws2812_state * state,
+                              struct ws2812_batch * batch, u64 *seq)
+{
+	const u32 __user * durations = u64_to_user_ptr(batch->durations);
+	struct ws2812_timed_frame frame;
+	u32 duration;
+	int ret;
+
+	if(batch->num_frames == 0 || batch->num_leds == 0 ||
+	   batch->num_leds > state->num_leds)
+		return -EINVAL;
+
+	frame.pixels = batch->pixels;
+	frame.num_leds = batch->num_leds;
+	frame.target_ns = batch->start_ns;
+
+	for(batch->queued = 0; batch->queued < batch->num_frames; batch->queued++)
+	{
+		if(get_user(duration, durations + batch->queued))
+			ret = -EFAULT;
+		else
+			ret = ws2812_queue_frame(state, &frame, seq);
+
+		/* Like a short write(), report the frames that were queued */
+		if(ret && batch->queued)
+			break;
+		if(ret)
+			return ret;
+
+		if(batch->queued == 0)
+			batch->seq = frame.seq;
+
+		frame.pixels += batch->num_leds * sizeof(uint32_t);
+		frame.target_ns += (s64) duration * NSEC_PER_USEC;
+	}
+
+	return 0;
+}
+
+/* Memory held by one cached frame */
+static size_t ws2812_cache_entry_size(struct ws2812_state * state)
+{
+	size_t size = state->buffer_size + state->num_leds * sizeof(uint32_t);
+
+	if(state->num_strips > 1)
+		size += state->encoded_size;
+
+	return sizeof(struct ws2812_cached) + size;
+}
+
+static bool ws2812_in_flight(struct ws2812_state * state,
+                             struct ws2812_buffer * buffer)
+{
+	unsigned long flags;
+	bool busy;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	busy = state->active == buffer || state->queued == buffer;
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return busy;
+}
+
+static void ws2812_cache_free(struct ws2812_state * state,
+                              struct ws2812_cached * cached)
+{
+	list_del(&cached->list);
+	ws2812_free_buffer(state, &cached->buffer);
+	kfree(cached);
+	state->cache_size -= ws2812_cache_entry_size(state);
+}
+
+/*
+ * Evict least recently used frames until size more bytes fit, frames being
+ * sent are kept.  Called with state->lock held.
+ */
+static int ws2812_cache_shrink(struct ws2812_state * state, size_t size)
+{
+	struct ws2812_cached * cached, * prev;
+
+	list_for_each_entry_safe_reverse(cached, prev, &state->cache, list)
+	{
+		if(state->cache_size + size <= state->cache_limit)
+			break;
+		if(!ws2812_in_flight(state, &cached->buffer))
+			ws2812_cache_free(state, cached);
+	}
+
+	return state->cache_size + size <= state->cache_limit ? 0 : -ENOSPC;
+}
+
+/*
+ * Encode a frame into a buffer of its own and add it to the cache.  It is
+ * encoded without the overlay layers, those are blended when it is shown.
+ * Called with state->lock held.
+ */
+static int ws2812_cache_frame(struct ws2812_state * state,
+                              struct ws2812_cached_frame * frame)
+{
+	struct ws2812_cached * cached;
+	int ret;
+
+	if(frame->num_leds == 0 || frame->num_leds > state->num_leds)
+		return -EINVAL;
+
+	ret = ws2812_cache_shrink(state, ws2812_cache_entry_size(state));
+	if(ret)
+		return ret;
+
+	cached = kzalloc(sizeof(struct ws2812_cached), GFP_KERNEL);
+	if(cached == NULL)
+		return -ENOMEM;
+
+	ret = ws2812_alloc_buffer(state, &cached->buffer);
+	if(ret)
+	{
+		kfree(cached);
+		return ret;
+	}
+
+	if(copy_from_user(cached->buffer.pixels, u64_to_user_ptr(frame->pixels),
+	                  frame->num_leds * sizeof(uint32_t)))
+	{
+		ws2812_free_buffer(state, &cached->buffer);
+		kfree(cached);
+		return -EFAULT;
+	}
+
+	cached->num_leds = frame->num_leds;
+	ws2812_encode_dirty(state, &cached->buffer, cached->buffer.pixels,
+	                    cached->num_leds);
+	ws2812_fill_reset(state, &cached->buffer, cached->num_leds);
+
+	/* 0 is never handed out */
+	if(++state->cache_handle == 0)
+		++state->cache_handle;
+	cached->handle = state->cache_handle;
+	frame->handle = cached->handle;
+
+	list_add(&cached->list, &state->cache);
+	state->cache_size += ws2812_cache_entry_size(state);
+
+	return 0;
+}
+
+/*
+ * Send a cached frame as it is.  With overlay layers active, or after the
+ * brightness changed while it is being sent, it goes through the normal
+ * encode path instead.  Called with state->lock held.
+ */
+static int ws2812_show_cached(struct ws2812_state * state, u32 handle, u64 *seq)
+{
+	struct ws2812_cached * cached = NULL, * entry;
+	struct ws2812_buffer * buffer;
+
+	list_for_each_entry(entry, &state->cache, list)
+	{
+		if(entry->handle == handle)
+		{
+			cached = entry;
+			break;
+		}
+	}
+
+	if(cached == NULL)
+	{
+		state->cache_misses++;
+		return -ENOENT;
+	}
+
+	state->cache_hits++;
+	list_move(&cached->list, &state->cache);
+	buffer = &cached->buffer;
+
+	if(state->layers_active ||
+	   (buffer->lut_gen != state->lut_gen && ws2812_in_flight(state, buffer)))
+	{
+		*seq = ws2812_show(state, buffer->pixels, cached->num_leds);
+		return 0;
+	}
+
+	/* Encoded with the old brightness, the pixels are still there */
+	if(buffer->lut_gen != state->lut_gen)
+	{
+		ws2812_encode_dirty(state, buffer, buffer->pixels, cached->num_leds);
+		ws2812_fill_reset(state, buffer, cached->num_leds);
+	}
+
+	/* Kept to blend again when a layer changes */
+	memcpy(state->base, buffer->pixels, cached->num_leds * sizeof(uint32_t));
+	state->base_len = cached->num_leds;
+
+	*seq = ws2812_submit(state, buffer);
+
+	return 0;
+}
+
+static void ws2812_cache_clear(struct ws2812_state * state)
+{
+	struct ws2812_cached * cached, * next;
+
+	list_for_each_entry_safe(cached, next, &state->cache, list)
+		ws2812_cache_free(state, cached);
+}
+
+/*
+ * Map a whole dma-buf into the kernel, the call changed in 5.11, 5.18 and
+ * 6.2.  Returns NULL if it cannot be mapped or is I/O memory.
+ */
+static void * ws2812_vmap(struct dma_buf * buf)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+	return dma_buf_vmap(buf);
+#else
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 18, 0)
+	struct dma_buf_map map;
+#else
+	struct iosys_map map;
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	if(dma_buf_vmap(buf, &map))
+		return NULL;
+#else
+	if(dma_buf_vmap_unlocked(buf, &map))
+		return NULL;
+#endif
+	if(map.is_iomem)
+	{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+		dma_buf_vunmap(buf, &map);
+#else
+		dma_buf_vunmap_unlocked(buf, &map);
+#endif
+		return NULL;
+	}
+	return map.vaddr;
+#endif
+}
+
+static void ws2812_vunmap(struct dma_buf * buf, void * vaddr)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+	dma_buf_vunmap(buf, vaddr);
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 18, 0)
+	struct dma_buf_map map = DMA_BUF_MAP_INIT_VADDR(vaddr);
+
+	dma_buf_vunmap(buf, &map);
+#else
+	struct iosys_map map = IOSYS_MAP_INIT_VADDR(vaddr);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	dma_buf_vunmap(buf, &map);
+#else
+	dma_buf_vunmap_unlocked(buf, &map);
+#endif
+#endif
+}
+
+/*
+ * Release the imported sampling buffer, called with state->lock held
+ */
+static void ws2812_sample_release(struct ws2812_state * state)
+{
+	if(state->sample_buf == NULL)
+		return;
+
+	ws2812_vunmap(state->sample_buf, state->sample_vaddr);
+	dma_buf_put(state->sample_buf);
+	kfree(state->sample_rects);
+	state->sample_buf = NULL;
+	state->sample_file = NULL;
+	state->sample_vaddr = NULL;
+	state->sample_rects = NULL;
+	state->sample_leds = 0;
+}
+
+/*
+ * Import the dma-buf of a sampling map and check every rectangle lies in
+ * the frame, the frame in the buffer, and the sums of a rectangle fit in
+ * 32 bits.  Replaces any buffer already imported once the new one is
+ * mapped, a map that fails keeps the old one.  Called with state->lock
+ * held.
+ */
+static int ws2812_set_sampling(struct ws2812_state * state,
+                               struct ws2812_file * wfile,
+                               struct ws2812_sampling * sampling)
+{
+	struct ws2812_sample_rect * rects;
+	struct ws2812_rect rect;
+	struct dma_buf * buf;
+	void * vaddr;
+	u64 end;
+	u32 i;
+	int ret;
+
+	if(sampling->fd < 0)
+	{
+		ws2812_sample_release(state);
+		return 0;
+	}
+
+	if(sampling->num_leds == 0 || sampling->num_leds > state->num_leds ||
+	   sampling->width == 0 || sampling->height == 0 ||
+	   sampling->width > U16_MAX || sampling->height > U16_MAX ||
+	   sampling->stride < sampling->width * 4 ||
+	   sampling->stride % 4 || sampling->offset % 4)
+		return -EINVAL;
+
+	/* Rectangle offsets are kept in 32 bits */
+	end = (u64) sampling->offset + (u64) (sampling->height - 1) * sampling->stride +
+	      sampling->width * 4;
+	if(end > U32_MAX)
+		return -EINVAL;
+
+	rects = kmalloc_array(sampling->num_leds, sizeof(*rects), GFP_KERNEL);
+	if(rects == NULL)
+		return -ENOMEM;
+
+	for(i = 0; i < sampling->num_leds; i++)
+	{
+		if(copy_from_user(&rect, u64_to_user_ptr(sampling->rects) +
+		                  i * sizeof(rect), sizeof(rect)))
+		{
+			ret = -EFAULT;
+			goto fail_rects;
+		}
+
+		if(rect.width == 0 || rect.height == 0 ||
+		   rect.x + rect.width > sampling->width ||
+		   rect.y + rect.height > sampling->height ||
+		   (u32) rect.width * rect.height > WS2812_SAMPLE_MAX_AREA)
+		{
+			ret = -EINVAL;
+			goto fail_rects;
+		}
+
+		rects[i].offset = (u64) sampling->offset + (u64) rect.y * sampling->stride +
+		                  rect.x * 4;
+		rects[i].width = rect.width;
+		rects[i].height = rect.height;
+		rects[i].recip = DIV_ROUND_UP_ULL(1ULL << 53, (u32) rect.width * rect.height);
+	}
+
+	buf = dma_buf_get(sampling->fd);
+	if(IS_ERR(buf))
+	{
+		ret = PTR_ERR(buf);
+		goto fail_rects;
+	}
+
+	if(end > buf->size)
+	{
+		ret = -EINVAL;
+		goto fail_buf;
+	}
+
+	vaddr = ws2812_vmap(buf);
+	if(vaddr == NULL)
+	{
+		ret = -ENOMEM;
+		goto fail_buf;
+	}
+
+	ws2812_sample_release(state);
+	state->sample_buf = buf;
+	state->sample_file = wfile;
+	state->sample_vaddr = vaddr;
+	state->sample_rects = rects;
+	state->sample_leds = sampling->num_leds;
+	state->sample_stride = sampling->stride;
+
+	return 0;
+fail_buf:
+	dma_buf_put(buf);
+fail_rects:
+	kfree(rects);
+	return ret;
+}
+
+/*
+ * Show the averages of the frame currently in the imported buffer, the
+ * CPU access brackets wait for the producer and keep the caches coherent.
+ * Called with state->lock held.
+ */
+static int ws2812_sample(struct ws2812_state * state, u64 *seq)
+{
+	u32 i;
+	int ret;
+
+	if(state->sample_buf == NULL)
+		return -ENODATA;
+
+	ret = dma_buf_begin_cpu_access(state->sample_buf, DMA_FROM_DEVICE);
+	if(ret)
+		return ret;
+
+	for(i = 0; i < state->sample_leds; i++)
+	{
+		const struct ws2812_sample_rect * rect = &state->sample_rects[i];
+		bool neon = false;
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+		neon = rect->width >= WS2812_NEON_BATCH && ws2812_can_use_neon();
+#endif
+		state->pixbuf[i] = ws2812_average_rect(state->sample_vaddr,
+		                                       state->sample_stride,
+		                                       rect, neon);
+	}
+
+	dma_buf_end_cpu_access(state->sample_buf, DMA_FROM_DEVICE);
+
+	ws2812_stop_effect(state);
+	*seq = ws2812_show(state, state->pixbuf, state->sample_leds);
+
+	return 0;
+}
+
+/*
+ * Collect the result of the oldest timed frame sent or dropped
+ */
+static int ws2812_frame_status(struct ws2812_state * state,
+                               struct ws2812_frame_status * status)
+{
+	unsigned long flags;
+	int ret = -EAGAIN;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	if(state->status_count)
+	{
+		*status = state->status[state->status_head];
+		state->status_head = (state->status_head + 1) % state->status_depth;
+		state->status_count--;
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return ret;
+}
+
+// Bytes per LED of each write() pixel format
+static const int ws2812_format_bytes[] = {
+	[WS2812_FORMAT_RGB32]  = 4,
+	[WS2812_FORMAT_RGB24]  = 3,
+	[WS2812_FORMAT_RGB565] = 2,
+	[WS2812_FORMAT_PAL8]   = 1,
+};
+
+/*
+ * Unpack count pixels written in a compact format into RGB32, one loop per
+ * format so the conversion does not branch per pixel
+ */
+static void ws2812_unpack(const struct ws2812_file * wfile, const uint8_t *in,
+                          uint32_t *out, int count)
+{
+	const uint16_t *in16 = (const uint16_t *) in;
+	int i;
+
+	switch(wfile->format)
+	{
+		case WS2812_FORMAT_RGB24:
+			for(i = 0; i < count; i++, in += 3)
+				out[i] = WS2812_RGB(in[0], in[1], in[2]);
+			break;
+		case WS2812_FORMAT_RGB565:
+			for(i = 0; i < count; i++)
+			{
+				uint32_t r = (in16[i] >> 11) & 0x1f;
+				uint32_t g = (in16[i] >> 5) & 0x3f;
+				uint32_t b = in16[i] & 0x1f;
+
+				out[i] = WS2812_RGB((r << 3) | (r >> 2),
+				                    (g << 2) | (g >> 4),
+				                    (b << 3) | (b >> 2));
+			}
+			break;
+		case WS2812_FORMAT_PAL8:
+			for(i = 0; i < count; i++)
+				out[i] = wfile->palette[in[i]];
+			break;
+	}
+}
+
+/*
+ * True while no written frame is waiting for show_work or the DMA, so a
+ * new one would not replace it
+ */
+static bool ws2812_writable(struct ws2812_state * state)
+{
+	unsigned long flags;
+	bool writable;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	writable = state->queued == NULL && !work_pending(&state->show_work);
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return writable;
+}
+
+/* Write to the PWM through DMA
+ * Function to write the RGB buffer to the WS2812 leds, the input buffer
+ * contains a sequence of pixels in the format of the file, RGB32 integers
+ * unless changed, these are then converted into the nibble per bit
+ * sequence required to drive the PWM.
+ *
+ * The file offset is the first LED times the pixel size, so pwrite() or
+ * lseek() update part of the strip and the rest keeps what was last
+ * written.  The offset is not advanced, each write() starts at the same
+ * LED.  Zones are offset to their first LED and cannot write past their
+ * end, a write that runs past it is cut short and returns the bytes of
+ * the whole pixels that fitted.
+ *
+ * write() only copies the pixels, show_work encodes and sends them.  The
+ * pixels may be split over several iovecs, writev() can gather fragments
+ * of a frame without copying them together first.  Non-blocking writes,
+ * O_NONBLOCK or IOCB_NOWAIT from io_uring, fail with -EAGAIN while the
+ * previous frame has not gone to the DMA yet instead of replacing it.
+ */
+static ssize_t ws2812_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	int first, num_leds, bpp;
+	struct ws2812_file * wfile = (struct ws2812_file *) iocb->ki_filp->private_data;
+	struct ws2812_state * state = wfile->state;
+	size_t count = iov_iter_count(from);
+	loff_t pos = iocb->ki_pos;
+	u32 offset;
+	bool nowait;
+
+	nowait = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+	if(nowait)
+	{
+		if(!ws2812_writable(state))
+			return -EAGAIN;
+		if(!mutex_trylock(&state->frame_lock))
+			return -EAGAIN;
+	}
+	else
+	{
+		mutex_lock(&state->frame_lock);
+	}
+
+	/* Bound the offset before dividing, a 64-bit division by a runtime
+	 * value needs libgcc helpers the 32-bit kernel does not have
+	 */
+	bpp = ws2812_format_bytes[wfile->format];
+	if(pos < 0)
+	{
+		mutex_unlock(&state->frame_lock);
+		return -EINVAL;
+	}
+	if(pos >= wfile->num_leds * bpp)
+	{
+		mutex_unlock(&state->frame_lock);
+		return -ENOSPC;
+	}
+	offset = pos;
+	if(offset % bpp)
+	{
+		mutex_unlock(&state->frame_lock);
+		return -EINVAL;
+	}
+	num_leds = min_t(size_t, count/bpp, wfile->num_leds - offset / bpp);
+	first = wfile->first + offset / bpp;
+	if(num_leds == 0)
+	{
+		mutex_unlock(&state->frame_lock);
+		return count ? -ENOSPC : 0;
+	}
+
+	/* RGB32 goes straight into the frame, anything else is unpacked */
+	if(!copy_from_iter_full(bpp == 4 ? (void *) (state->frame + first) : state->inbuf,
+	                        num_leds * bpp, from))
+	{
+		mutex_unlock(&state->frame_lock);
+		return -EFAULT;
+	}
+	if(bpp != 4)
+		ws2812_unpack(wfile, state->inbuf, state->frame + first, num_leds);
+
+	if(state->frame_end == state->frame_first)
+	{
+		state->frame_first = first;
+		state->frame_end = first + num_leds;
+	}
+	else
+	{
+		state->frame_first = min(state->frame_first, first);
+		state->frame_end = max(state->frame_end, first + num_leds);
+	}
+	wfile->written = true;
+
+	mutex_unlock(&state->frame_lock);
+
+	queue_work(state->wq, &state->show_work);
+
+	return num_leds * bpp;
+}
+
+/*
+ * Encode and send what write() has drawn.  Only the LEDs written since the
+ * last time are merged into base, so a zone write leaves the rest of the
+ * strip showing whatever was shown last, and the dirty tracking only
+ * encodes the range that changed.
+ * Writes that arrive while this runs, or while the frame waits for the DMA
+ * or the frame clock, are gathered into the next frame so writes to
+ * several zones go out in a single transfer.
+ */
+static void ws2812_show_work(struct work_struct *work)
+{
+	struct ws2812_state * state = container_of(work, struct ws2812_state, show_work);
+	int first, end, num_leds;
+
+	mutex_lock(&state->lock);
+
+	/* Straight into base, which ws2812_show() would copy it to anyway.
+	 * Nothing left means an earlier run already sent these writes.
+	 */
+	mutex_lock(&state->frame_lock);
+	first = state->frame_first;
+	end = state->frame_end;
+	memcpy(state->base + first, state->frame + first,
+	       (end - first) * sizeof(uint32_t));
+	state->frame_first = state->frame_end = 0;
+	mutex_unlock(&state->frame_lock);
+
+	if(first == end)
+	{
+		mutex_unlock(&state->lock);
+		return;
+	}
+
+	ws2812_stop_effect(state);
+
+	num_leds = max(state->base_len, end);
+	state->show_seq = ws2812_show(state, state->base, num_leds);
+
+	mutex_unlock(&state->lock);
+
+	/* poll() waits for this as well as the DMA */
+	wake_up_interruptible(&state->wait);
+}
+
+/*
+ * Drop the sampling buffer if this file imported it, nothing else would
+ * release it once the importer has gone
+ */
+static int ws2812_release(struct inode *inode, struct file *file)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) file->private_data;
+	struct ws2812_state * state = wfile->state;
+
+	mutex_lock(&state->lock);
+	if(state->sample_file == wfile)
+		ws2812_sample_release(state);
+	mutex_unlock(&state->lock);
+
+	kfree(wfile);
+
+	return 0;
+}
+
+/*
+ * Seek to an LED, offsets are LED index times the pixel size of the
+ * file's format
+ */
+static loff_t ws2812_llseek(struct file *filp, loff_t offset, int whence)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) filp->private_data;
+
+	return fixed_size_llseek(filp, offset, whence,
+	                         wfile->num_leds * ws2812_format_bytes[wfile->format]);
+}
+
+/*
+ * Map the pixel slots so userspace can render frames without a copy
+ */
+static int ws2812_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) filp->private_data;
+	struct ws2812_state * state = wfile->state;
+
+	return remap_vmalloc_range(vma, state->slots, vma->vm_pgoff);
+}
+
+/*
+ * Writable while no frame is waiting to be sent, readable while timed frame
+ * results are waiting to be collected
+ */
+static __poll_t ws2812_poll(struct file *filp, poll_table *wait)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) filp->private_data;
+	struct ws2812_state * state = wfile->state;
+	unsigned long flags;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &state->wait, wait);
+
+	if(ws2812_writable(state))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	spin_lock_irqsave(&state->dma_lock, flags);
+	if(state->status_count)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	spin_unlock_irqrestore(&state->dma_lock, flags);
+
+	return mask;
+}
+
+/*
+ * Wait until the last frame submitted or written through this file, and
+ * everything submitted before it, has been sent
+ */
+static int ws2812_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) filp->private_data;
+	struct ws2812_state * state = wfile->state;
+	bool written;
+	u64 seq;
+
+	/* Cleared before the flush, so a write() that sets it again after
+	 * this is flushed by the next fsync()
+	 */
+	mutex_lock(&state->frame_lock);
+	written = wfile->written;
+	wfile->written = false;
+	mutex_unlock(&state->frame_lock);
+
+	/* Once show_work is idle everything written has been submitted */
+	if(written)
+		flush_work(&state->show_work);
+
+	/* The ioctls update seq under the lock, a 64 bit read of it while
+	 * waiting could tear on 32 bit ARM
+	 */
+	mutex_lock(&state->lock);
+	if(written)
+		wfile->seq = max(wfile->seq, state->show_seq);
+	seq = wfile->seq;
+	mutex_unlock(&state->lock);
+
+	return wait_event_interruptible(state->wait,
+	                                ws2812_frame_done(state, seq));
+}
+
+static long ws2812_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct ws2812_file * wfile = (struct ws2812_file *) filp->private_data;
+	struct ws2812_state * state = wfile->state;
+	void __user *argp = (void __user *) arg;
+
+	/* Zones only choose how they are written, the rest is for the strip */
+	if(wfile->zone && cmd != WS2812_IOC_SET_FORMAT &&
+	   cmd != WS2812_IOC_SET_PALETTE)
+		return -ENOTTY;
+
+	switch(cmd)
+	{
+		case WS2812_IOC_INFO:
+		{
+			struct ws2812_info info = {
+				.num_leds = state->num_leds,
+				.slots = WS2812_NUM_SLOTS,
+				.slot_size = state->slot_size,
+				.next = READ_ONCE(state->next_slot),
+			};
+
+			if(copy_to_user(argp, &info, sizeof(info)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_COMMIT:
+		{
+			struct ws2812_commit commit;
+
+			if(copy_from_user(&commit, argp, sizeof(commit)))
+				return -EFAULT;
+			if(commit.slot >= WS2812_NUM_SLOTS)
+				return -EINVAL;
+
+			/* Send what write() left to show_work first, so it
+			 * cannot replace this frame later.  The same goes for
+			 * every ioctl that shows a frame or starts an effect.
+			 */
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ws2812_stop_effect(state);
+			wfile->seq = ws2812_show(state,
+			                         state->slots + commit.slot * state->slot_size,
+			                         state->num_leds);
+			/* Encoded already, so any slot but this one is free */
+			state->next_slot = (commit.slot + 1) % WS2812_NUM_SLOTS;
+			commit.next = state->next_slot;
+			mutex_unlock(&state->lock);
+
+			if(copy_to_user(argp, &commit, sizeof(commit)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_SET_REFRESH:
+		{
+			u32 hz;
+			int ret;
+
+			if(get_user(hz, (u32 __user *) argp))
+				return -EFAULT;
+
+			mutex_lock(&state->lock);
+			ret = ws2812_set_refresh(state, hz);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_QUEUE_FRAME:
+		{
+			struct ws2812_timed_frame frame;
+			int ret;
+
+			if(copy_from_user(&frame, argp, sizeof(frame)))
+				return -EFAULT;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ret = ws2812_queue_frame(state, &frame, &wfile->seq);
+			mutex_unlock(&state->lock);
+			if(ret)
+				return ret;
+
+			if(copy_to_user(argp, &frame, sizeof(frame)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_QUEUE_BATCH:
+		{
+			struct ws2812_batch batch;
+			int ret;
+
+			if(copy_from_user(&batch, argp, sizeof(batch)))
+				return -EFAULT;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ret = ws2812_queue_batch(state, &batch, &wfile->seq);
+			mutex_unlock(&state->lock);
+			if(ret)
+				return ret;
+
+			if(copy_to_user(argp, &batch, sizeof(batch)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_FRAME_STATUS:
+		{
+			struct ws2812_frame_status status;
+			int ret;
+
+			ret = ws2812_frame_status(state, &status);
+			if(ret)
+				return ret;
+
+			if(copy_to_user(argp, &status, sizeof(status)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_SET_EFFECT:
+		{
+			struct ws2812_effect effect;
+			int ret;
+
+			if(copy_from_user(&effect, argp, sizeof(effect)))
+				return -EFAULT;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ret = ws2812_set_effect(state, &effect);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_SET_LAYER:
+		{
+			struct ws2812_layer layer;
+			int ret;
+
+			if(copy_from_user(&layer, argp, sizeof(layer)))
+				return -EFAULT;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ret = ws2812_set_layer(state, &layer);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_CACHE_FRAME:
+		{
+			struct ws2812_cached_frame frame;
+			int ret;
+
+			if(copy_from_user(&frame, argp, sizeof(frame)))
+				return -EFAULT;
+
+			mutex_lock(&state->lock);
+			ret = ws2812_cache_frame(state, &frame);
+			mutex_unlock(&state->lock);
+			if(ret)
+				return ret;
+
+			if(copy_to_user(argp, &frame, sizeof(frame)))
+				return -EFAULT;
+			return 0;
+		}
+		case WS2812_IOC_SHOW_CACHED:
+		{
+			u32 handle;
+			int ret;
+
+			if(get_user(handle, (u32 __user *) argp))
+				return -EFAULT;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ws2812_stop_effect(state);
+			ret = ws2812_show_cached(state, handle, &wfile->seq);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_SET_SAMPLING:
+		{
+			struct ws2812_sampling sampling;
+			int ret;
+
+			if(copy_from_user(&sampling, argp, sizeof(sampling)))
+				return -EFAULT;
+
+			mutex_lock(&state->lock);
+			ret = ws2812_set_sampling(state, wfile, &sampling);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_SAMPLE:
+		{
+			int ret;
+
+			flush_work(&state->show_work);
+			mutex_lock(&state->lock);
+			ret = ws2812_sample(state, &wfile->seq);
+			mutex_unlock(&state->lock);
+
+			return ret;
+		}
+		case WS2812_IOC_SET_FORMAT:
+		{
+			u32 format;
+
+			if(get_user(format, (u32 __user *) argp))
+				return -EFAULT;
+			if(format >= ARRAY_SIZE(ws2812_format_bytes))
+				return -EINVAL;
+
+			/* Taken under the lock so a write() in progress sees
+			 * either the old format or the new one
+			 */
+			mutex_lock(&state->frame_lock);
+			wfile->format = format;
+			mutex_unlock(&state->frame_lock);
+
+			return 0;
+		}
+		case WS2812_IOC_SET_PALETTE:
+		{
+			int ret = 0;
+
+			mutex_lock(&state->frame_lock);
+			if(copy_from_user(wfile->palette, argp, sizeof(wfile->palette)))
+				ret = -EFAULT;
+			mutex_unlock(&state->frame_lock);
+
+			return ret;
+		}
+		default:
+			return -ENOTTY;
+	}
+}
+
+
+static ssize_t brightness_show(struct device *dev,
+                               struct device_attribute *attr, char *buf)
+{
+	struct ws2812_state * state = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", state->brightness);
+}
+
+static ssize_t brightness_store(struct device *dev,
+                                struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+	struct ws2812_state * state = dev_get_drvdata(dev);
+	u8 brightness;
+	int ret;
+
+	ret = kstrtou8(buf, 0, &brightness);
+	if(ret)
+		return ret;
+
+	mutex_lock(&state->lock);
+	state->brightness = brightness;
+	ws2812_update_lut(state);
+	mutex_unlock(&state->lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(brightness);
+
+static ssize_t cache_limit_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+	struct ws2812_state * state = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%zu\n", state->cache_limit);
+}
+
+static ssize_t cache_limit_store(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+	struct ws2812_state * state = dev_get_drvdata(dev);
+	unsigned long limit;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &limit);
+	if(ret)
+		return ret;
+
+	/* Evicts down to the new limit, frames being sent go later */
+	mutex_lock(&state->lock);
+	state->cache_limit = limit;
+	ws2812_cache_shrink(state, 0);
+	mutex_unlock(&state->lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(cache_limit);
+
+static struct attribute *ws2812_attrs[] = {
+	&dev_attr_brightness.attr,
+	&dev_attr_cache_limit.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(ws2812);
+
+struct file_operations ws2812_fops = {
+	.owner = THIS_MODULE,
+	.llseek = ws2812_llseek,
+	.read = NULL,
+	.write_iter = ws2812_write_iter,
+	.poll = ws2812_poll,
+	.fsync = ws2812_fsync,
+	.unlocked_ioctl = ws2812_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = ws2812_mmap,
+	.open = ws2812_open,
+	.release = ws2812_release,
+};
+
+/* Zones are written like the strip but cannot map or control it */
+struct file_operations ws2812_zone_fops = {
+	.owner = THIS_MODULE,
+	.llseek = ws2812_llseek,
+	.write_iter = ws2812_write_iter,
+	.poll = ws2812_poll,
+	.fsync = ws2812_fsync,
+	.unlocked_ioctl = ws2812_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.open = ws2812_zone_open,
+	.release = ws2812_release,
+};
+
+static void ws2812_free_buffers(struct ws2812_state * state)
+{
+	int i;
+
+	for(i = 0; i < WS2812_NUM_BUFFERS; i++)
+		ws2812_free_buffer(state, &state->buffers[i]);
+	for(i = 0; i < state->queue_depth; i++)
+		ws2812_free_buffer(state, &state->timed[i].buffer);
+	ws2812_cache_clear(state);
+}
+
+static void ws2812_remove_zones(struct ws2812_state * state)
+{
+	struct ws2812_zone * zone;
+
+	while(state->num_zones)
+	{
+		zone = &state->zones[--state->num_zones];
+		device_destroy(ws2812_class, zone->devt);
+		cdev_del(&zone->cdev);
+		ida_free(&ws2812_minors, MINOR(zone->devt));
+	}
+	kfree(state->zones);
+	state->zones = NULL;
+}
+
+/*
+ * Create a char device /dev/ws2812-<id>-<label> for every zone child node
+ * of the strip.  Zones may overlap, the LEDs they share take whichever
+ * write came last.  Zones that do not fit the strip are skipped.
+ */
+static int ws2812_add_zones(struct ws2812_state * state)
+{
+	struct device_node *child;
+	struct ws2812_zone * zone;
+	struct device * zdev;
+	const char *label;
+	int count, minor, ret;
+
+	count = of_get_available_child_count(state->dev->of_node);
+	if(count == 0)
+		return 0;
+
+	state->zones = kcalloc(count, sizeof(struct ws2812_zone), GFP_KERNEL);
+	if(state->zones == NULL)
+		return -ENOMEM;
+
+	for_each_available_child_of_node(state->dev->of_node, child)
+	{
+		zone = &state->zones[state->num_zones];
+		memset(zone, 0, sizeof(*zone));
+		zone->state = state;
+		label = child->name;
+		of_property_read_string(child, "label", &label);
+		of_property_read_u32(child, "rpi,first-led", &zone->first);
+		of_property_read_u32(child, "rpi,num_leds", &zone->num_leds);
+
+		if(zone->num_leds == 0 || zone->first >= state->num_leds ||
+		   zone->num_leds > state->num_leds - zone->first)
+		{
+			dev_warn(state->dev, "zone %s does not fit the strip, skipped\n",
+			         label);
+			continue;
+		}
+
+		minor = ida_alloc_max(&ws2812_minors, WS2812_MAX_MINORS - 1, GFP_KERNEL);
+		if(minor < 0)
+		{
+			pr_err("Too many ws2812 devices for zone %s\n", label);
+			ret = minor;
+			goto fail;
+		}
+		zone->devt = MKDEV(MAJOR(ws2812_devt), minor);
+
+		zone->cdev.owner = THIS_MODULE;
+		cdev_init(&zone->cdev, &ws2812_zone_fops);
+		ret = cdev_add(&zone->cdev, zone->devt, 1);
+		if(ret)
+		{
+			pr_err("CDEV failed for zone %s\n", label);
+			ida_free(&ws2812_minors, minor);
+			goto fail;
+		}
+
+		zdev = device_create(ws2812_class, state->dev, zone->devt, zone,
+		                     DRIVER_NAME "-%d-%s", state->id, label);
+		if(IS_ERR(zdev))
+		{
+			pr_err("Unable to create device for zone %s\n", label);
+			ret = PTR_ERR(zdev);
+			cdev_del(&zone->cdev);
+			ida_free(&ws2812_minors, minor);
+			goto fail;
+		}
+
+		state->num_zones++;
+	}
+
+	return 0;
+fail:
+	of_node_put(child);
+	ws2812_remove_zones(state);
+	return ret;
+}
+
+/*
+ * Probe function
+ */
+static int ws2812_probe(struct platform_device *pdev)
+{
+	int i, minor, ret;
+	u32 refresh_hz = 0;
+	const char *order = ws2812_layouts[0].order;
+	char name[16];
+	struct device *dev = &pdev->dev;
+	struct device *cdev_dev;
+	struct device_node *node = dev->of_node;
+	struct ws2812_state * state;
+	const __be32 *addr;
+	struct resource *res;
+	struct dma_slave_config cfg =
+	{
+		.src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.slave_id = PWM_DMA_DREQ,
+		.direction = DMA_MEM_TO_DEV,
+		.src_addr = 0,
+	};
+
+	if(node == NULL)
+	{
+		pr_err("Require device tree entry\n");
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	state = kzalloc(sizeof(struct ws2812_state), GFP_KERNEL);
+	if (!state) {
+		pr_err("Can't allocate state\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	state->dev = dev;
+	state->brightness = 255;
+	mutex_init(&state->lock);
+	spin_lock_init(&state->dma_lock);
+	init_waitqueue_head(&state->wait);
+	hrtimer_init(&state->frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	state->frame_timer.function = ws2812_frame_tick;
+	hrtimer_init(&state->queue_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	state->queue_timer.function = ws2812_queue_tick;
+	hrtimer_init(&state->effect_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	state->effect_timer.function = ws2812_effect_tick;
+	INIT_WORK(&state->effect_work, ws2812_effect_work);
+	mutex_init(&state->frame_lock);
+	INIT_WORK(&state->show_work, ws2812_show_work);
+	INIT_LIST_HEAD(&state->timed_free);
+	INIT_LIST_HEAD(&state->timed_queue);
+	INIT_LIST_HEAD(&state->cache);
+	state->cache_limit = WS2812_CACHE_LIMIT;
+	ws2812_update_lut(state);
+
+	state->id = ida_alloc_max(&ws2812_ida, WS2812_MAX_DEVICES - 1, GFP_KERNEL);
+	if(state->id < 0)
+	{
+		pr_err("Too many ws2812 devices\n");
+		ret = state->id;
+		goto fail_malloc;
+	}
+	minor = ida_alloc_max(&ws2812_minors, WS2812_MAX_MINORS - 1, GFP_KERNEL);
+	if(minor < 0)
+	{
+		pr_err("Too many ws2812 devices\n");
+		ret = minor;
+		goto fail_id;
+	}
+	state->devt = MKDEV(MAJOR(ws2812_devt), minor);
+
+	platform_set_drvdata(pdev, state);
+
+	/* get parameters from device tree */
+	of_property_read_u32(node,
+	                     "rpi,invert",
+	                     &state->invert);
+	of_property_read_u32(node,
+	                     "rpi,num_leds",
+	                     &state->strip_leds[0]);
+	of_property_read_u32(node,
+	                     "rpi,num_leds2",
+	                     &state->strip_leds[1]);
+	of_property_read_u32(node,
+	                     "rpi,refresh-hz",
+	                     &refresh_hz);
+	state->queue_depth = WS2812_QUEUE_DEPTH;
+	of_property_read_u32(node,
+	                     "rpi,queue-depth",
+	                     &state->queue_depth);
+	state->symbols = 4;
+	of_property_read_u32(node,
+	                     "rpi,symbols-per-bit",
+	                     &state->symbols);
+	of_property_read_string(node,
+	                        "rpi,pixel-order",
+	                        &order);
+
+	state->layout = ws2812_find_layout(order);
+	if(state->layout == NULL)
+	{
+		pr_err("Unsupported pixel order %s\n", order);
+		ret = -EINVAL;
+		goto fail_minor;
+	}
+
+	if(state->queue_depth == 0 || state->queue_depth > WS2812_MAX_QUEUE_DEPTH)
+	{
+		pr_err("Unsupported queue depth %u\n", state->queue_depth);
+		ret = -EINVAL;
+		goto fail_minor;
+	}
+
+	if(state->symbols != 3 && state->symbols != 4)
+	{
+		pr_err("Unsupported encoding of %u symbols per bit\n", state->symbols);
+		ret = -EINVAL;
+		goto fail_minor;
+	}
+
+	/* The reset time is set by the rate the PWM shifts symbols out at,
+	 * taken from its clock when the node has one.  Both encodings run
+	 * at the same 2.4MHz otherwise.
+	 */
+	state->clk = devm_clk_get_optional(dev, NULL);
+	if(IS_ERR(state->clk))
+	{
+		pr_err("Failed to get the PWM clock\n");
+		ret = PTR_ERR(state->clk);
+		goto fail_minor;
+	}
+	state->symbol_rate = clk_get_rate(state->clk);
+	if(state->symbol_rate == 0)
+		state->symbol_rate = WS2812_PWM_CLOCK;
+	state->bytes_per_led = state->layout->channels *
+	                       (state->symbols == 3 ? BYTES_PER_CHANNEL3 : BYTES_PER_CHANNEL);
+	state->reset_bytes = 4 * DIV_ROUND_UP(state->symbol_rate / 1000 * RESET_US,
+	                                      32 * 1000);
+
+	/* A second strip on PWM channel 2 shares the DMA transfer, each strip
+	 * is encoded from a word boundary
+	 */
+	state->num_strips = state->strip_leds[1] ? 2 : 1;
+	state->num_leds = state->strip_leds[0] + state->strip_leds[1];
+	state->strip_max = max(state->strip_leds[0], state->strip_leds[1]);
+	state->strip_offset[1] = round_up(state->strip_leds[0] * state->bytes_per_led, 4);
+	state->encoded_size = state->strip_offset[1] +
+	                      round_up(state->strip_leds[1] * state->bytes_per_led, 4);
+	state->buffer_size = state->num_strips *
+	                     (round_up(state->strip_max * state->bytes_per_led, 4) +
+	                      state->reset_bytes);
+
+	state->pixbuf = kmalloc(state->num_leds * sizeof(int), GFP_KERNEL);
+	if(state->pixbuf == NULL)
+	{
+		pr_err("Failed to allocate internal buffer\n");
+		ret = -ENOMEM;
+		goto fail_minor;
+	}
+
+	state->base = kcalloc(state->num_leds, sizeof(uint32_t), GFP_KERNEL);
+	state->composite = kmalloc(state->num_leds * sizeof(uint32_t), GFP_KERNEL);
+	if(state->base == NULL || state->composite == NULL)
+	{
+		pr_err("Failed to allocate layer buffers\n");
+		ret = -ENOMEM;
+		goto fail_layers;
+	}
+
+	state->frame = kcalloc(state->num_leds, sizeof(uint32_t), GFP_KERNEL);
+	if(state->frame == NULL)
+	{
+		pr_err("Failed to allocate frame\n");
+		ret = -ENOMEM;
+		goto fail_layers;
+	}
+
+	/* Big enough for the largest compact format */
+	state->inbuf = kmalloc(state->num_leds * 3, GFP_KERNEL);
+	if(state->inbuf == NULL)
+	{
+		pr_err("Failed to allocate input buffer\n");
+		ret = -ENOMEM;
+		goto fail_frame;
+	}
+
+	state->slot_size = PAGE_ALIGN(state->num_leds * sizeof(uint32_t));
+	state->slots = vmalloc_user(WS2812_NUM_SLOTS * state->slot_size);
+	if(state->slots == NULL)
+	{
+		pr_err("Failed to allocate pixel slots\n");
+		ret = -ENOMEM;
+		goto fail_inbuf;
+	}
+
+	/* The DMA buffers of timed frames are only allocated once used */
+	state->status_depth = state->queue_depth * WS2812_STATUS_PER_FRAME;
+	state->timed = kcalloc(state->queue_depth, sizeof(*state->timed), GFP_KERNEL);
+	state->status = kcalloc(state->status_depth, sizeof(*state->status), GFP_KERNEL);
+	if(state->timed == NULL || state->status == NULL)
+	{
+		pr_err("Failed to allocate timed queue\n");
+		ret = -ENOMEM;
+		goto fail_slots;
+	}
+	for(i = 0; i < state->queue_depth; i++)
+		list_add_tail(&state->timed[i].list, &state->timed_free);
+
+	/* base address in dma-space */
+	addr = of_get_address(node, 0, NULL, NULL);
+	if (!addr) {
+		dev_err(dev, "could not get DMA-register address - not using dma mode\n");
+		ret = -EINVAL;
+		goto fail_slots;
+	}
+	state->phys_addr = be32_to_cpup(addr);
+	pr_err("bus_addr = %pa\n", &state->phys_addr);
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	state->ioaddr = devm_ioremap_resource(&pdev->dev, res);
+	if (IS_ERR(state->ioaddr)) {
+                pr_err("Failed to get register resource\n");
+		ret = PTR_ERR(state->ioaddr);
+		goto fail_slots;
+	}
+
+	pr_err("ioaddr = 0x%x\n", (int) state->ioaddr);
+
+	for(i = 0; i < WS2812_NUM_BUFFERS; i++)
+	{
+		ret = ws2812_alloc_buffer(state, &state->buffers[i]);
+		if(ret)
+		{
+			pr_err("Failed to allocate DMA buffer\n");
+			goto fail_buffer;
+		}
+	}
+
+	state->dma_chan = dma_request_slave_channel(dev, "pwm_dma");
+	if(state->dma_chan == NULL)
+	{
+		pr_err("Failed to request DMA channel");
+		ret = -ENODEV;
+		goto fail_buffer;
+	}
+
+	/* request a DMA channel */
+	cfg.dst_addr = state->phys_addr + PWM_FIFO1;
+	ret = dmaengine_slave_config(state->dma_chan, &cfg);
+	if (ret) {
+		pr_err("Can't allocate DMA channel\n");
+		goto fail_dma_init;
+	}
+	pwm_init(state);
+
+	// Enable the LED power
+	state->led_en = devm_gpiod_get(dev, "led-en", GPIOD_OUT_HIGH);
+
+	/* Encoding for write() and effects, the CPUs it runs on can be set
+	 * in /sys/devices/virtual/workqueue/ws2812-<id>/cpumask
+	 */
+	state->wq = alloc_workqueue(DRIVER_NAME "-%d",
+	                            WQ_UNBOUND | WQ_HIGHPRI | WQ_SYSFS, 1, state->id);
+	if(state->wq == NULL)
+	{
+		pr_err("Failed to allocate workqueue\n");
+		ret = -ENOMEM;
+		goto fail_dma_init;
+	}
+
+	snprintf(name, sizeof(name), DRIVER_NAME "-%d", state->id);
+	state->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_u64("frames", 0444, state->debugfs, &state->frames);
+	debugfs_create_u64("sync_bytes_saved", 0444, state->debugfs,
+	                   &state->sync_bytes_saved);
+	debugfs_create_u64("frames_dropped", 0444, state->debugfs,
+	                   &state->frames_dropped);
+	debugfs_create_u64("leds_encoded", 0444, state->debugfs,
+	                   &state->leds_encoded);
+	debugfs_create_u32("last_leds_encoded", 0444, state->debugfs,
+	                   &state->last_leds_encoded);
+	debugfs_create_u64("cache_hits", 0444, state->debugfs,
+	                   &state->cache_hits);
+	debugfs_create_u64("cache_misses", 0444, state->debugfs,
+	                   &state->cache_misses);
+
+	clear_leds(state);
+
+	mutex_lock(&state->lock);
+	if(ws2812_set_refresh(state, refresh_hz))
+		pr_err("Invalid refresh rate %u, sending frames unpaced\n",
+		       refresh_hz);
+	mutex_unlock(&state->lock);
+
+	// Create character device interface /dev/ws2812-<id>
+	state->cdev.owner = THIS_MODULE;
+	cdev_init(&state->cdev, &ws2812_fops);
+
+	ret = cdev_add(&state->cdev, state->devt, 1);
+	if(ret) {
+		pr_err("CDEV failed\n");
+		goto fail_stop;
+	}
+
+	cdev_dev = device_create_with_groups(ws2812_class, dev, state->devt, state,
+	                                     ws2812_groups, DRIVER_NAME "-%d",
+	                                     state->id);
+	if(IS_ERR(cdev_dev))
+	{
+		pr_err("Unable to create device ws2812-%d\n", state->id);
+		ret = PTR_ERR(cdev_dev);
+		goto fail_cdev;
+	}
+
+	ret = ws2812_add_zones(state);
+	if(ret)
+		goto fail_device;
+
+	return 0;
+fail_device:
+	device_destroy(ws2812_class, state->devt);
+fail_cdev:
+	cdev_del(&state->cdev);
+fail_stop:
+	destroy_workqueue(state->wq);
+	hrtimer_cancel(&state->frame_timer);
+	dmaengine_terminate_sync(state->dma_chan);
+	debugfs_remove_recursive(state->debugfs);
+fail_dma_init:
+	dma_release_channel(state->dma_chan);
+fail_buffer:
+	ws2812_free_buffers(state);
+fail_slots:
+	kfree(state->status);
+	kfree(state->timed);
+	vfree(state->slots);
+fail_inbuf:
+	kfree(state->inbuf);
+fail_frame:
+	kfree(state->frame);
+fail_layers:
+	kfree(state->composite);
+	kfree(state->base);
+	kfree(state->pixbuf);
+fail_minor:
+	ida_free(&ws2812_minors, MINOR(state->devt));
+fail_id:
+	ida_free(&ws2812_ida, state->id);
+fail_malloc:
+	kfree(state);
+fail:
+
+	return ret;
+}
+
+
+static int ws2812_remove(struct platform_device *pdev)
+{
+	struct ws2812_state *state = platform_get_drvdata(pdev);
+	int i;
+
+	platform_set_drvdata(pdev, NULL);
+
+	ws2812_remove_zones(state);
+	device_destroy(ws2812_class, state->devt);
+	cdev_del(&state->cdev);
+	hrtimer_cancel(&state->effect_timer);
+	cancel_work_sync(&state->effect_work);
+	cancel_work_sync(&state->show_work);
+	destroy_workqueue(state->wq);
+	hrtimer_cancel(&state->frame_timer);
+	hrtimer_cancel(&state->queue_timer);
+	dmaengine_terminate_sync(state->dma_chan);
+	dma_release_channel(state->dma_chan);
+	debugfs_remove_recursive(state->debugfs);
+	ws2812_sample_release(state);
+	ws2812_free_buffers(state);
+	kfree(state->status);
+	kfree(state->timed);
+	vfree(state->slots);
+	kfree(state->inbuf);
+	kfree(state->frame);
+	for(i = 0; i < WS2812_LAYERS; i++)
+		kfree(state->layers[i].pixels);
+	kfree(state->composite);
+	kfree(state->base);
+	kfree(state->pixbuf);
+	ida_free(&ws2812_minors, MINOR(state->devt));
+	ida_free(&ws2812_ida, state->id);
+	kfree(state);
+
+	return 0;
+}
+
+static const struct of_device_id ws2812_match[] = {
+	{ .compatible = "rpi,ws2812" },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, ws2812_match);
+
+static struct platform_driver ws2812_driver = {
+	.probe      = ws2812_probe,
+	.remove     = ws2812_remove,
+	.driver     = {
+	.name       = DRIVER_NAME,
+	.owner      = THIS_MODULE,
+	.of_match_table = ws2812_match,
+	},
+};
+
+static int __init ws2812_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&ws2812_devt, 0, WS2812_MAX_MINORS, DRIVER_NAME);
+	if(ret < 0)
+	{
+		pr_err("Unable to create chrdev region\n");
+		return ret;
+	}
+
+	ws2812_class = class_create(THIS_MODULE, DRIVER_NAME);
+	if(IS_ERR(ws2812_class))
+	{
+		pr_err("Unable to create class ws2812\n");
+		unregister_chrdev_region(ws2812_devt, WS2812_MAX_MINORS);
+		return PTR_ERR(ws2812_class);
+	}
+
+	ret = platform_driver_register(&ws2812_driver);
+	if(ret)
+	{
+		class_destroy(ws2812_class);
+		unregister_chrdev_region(ws2812_devt, WS2812_MAX_MINORS);
+	}
+
+	return ret;
+}
+module_init(ws2812_init);
+
+static void __exit ws2812_exit(void)
+{
+	platform_driver_unregister(&ws2812_driver);
+	class_destroy(ws2812_class);
+	unregister_chrdev_region(ws2812_devt, WS2812_MAX_MINORS);
+	ida_destroy(&ws2812_minors);
+	ida_destroy(&ws2812_ida);
+}
+module_exit(ws2812_exit);
+
+MODULE_ALIAS("platform:ws2812");
+MODULE_DESCRIPTION("WS2812 PWM driver");
+MODULE_LICENSE("GPL v2");
+MODULE_IMPORT_NS(DMA_BUF);
+MODULE_AUTHOR("Gordon Hollingworth");
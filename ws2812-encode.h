@@ -0,0 +1,357 @@
+/*
+ * Raspberry Pi WS2812 PWM driver
+ *
+ * Scalar symbol encoders, the pixel layouts built on them, layer blending
+ * and frame sampling, included by ws2812-core.c and by the host tests in
+ * host/ which check the NEON code against them
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _WS2812_ENCODE_H
+#define _WS2812_ENCODE_H
+
+#include <linux/types.h>
+
+#include "ws2812.h"
+#include "ws2812-ioctl.h"
+
+/* Each LED is controlled with an 8 bit value per colour
+ * channel, each bit is created from a nibble of data either
+ * 1000 or 1110 so to create 8 bits you need 4 bytes
+ * of PWM output, 12 for an RGB LED
+ */
+#define BYTES_PER_CHANNEL 4
+
+/* With the PWM clocked at 3 symbols per bit a bit is either 100 or 110,
+ * 3 bytes per channel
+ */
+#define BYTES_PER_CHANNEL3 3
+
+// LED serial output
+// 4 bits make up a single bit of the output
+// 1 1 1 0  -- 1
+// 1 0 0 0  -- 0
+//
+// Plus require a space of 50 microseconds for reset
+// 24 bits per led
+//
+// (24 * 4) / 8 = 12 bytes per led
+//
+//  red = 0xff0000 == 0xeeeeeeee 0x88888888 0x88888888
+#ifdef WS2812_TABLE_ENCODER
+/* Symbol word for every colour byte, bit n of the byte becomes nibble n of
+ * the word.  The PWM shifts each word out MSB first so the colour goes out
+ * MSB first as well, and the little endian byte layout in memory matches
+ * what the 2 bit switch encoder below produces.
+ */
+#define SYM_BIT(v, n) ((((v) >> (n)) & 1 ? 0xeU : 0x8U) << (4 * (n)))
+#define SYM(v)   (SYM_BIT(v, 0) | SYM_BIT(v, 1) | SYM_BIT(v, 2) | SYM_BIT(v, 3) | \
+                  SYM_BIT(v, 4) | SYM_BIT(v, 5) | SYM_BIT(v, 6) | SYM_BIT(v, 7))
+#define SYM4(v)  SYM(v), SYM((v) + 1), SYM((v) + 2), SYM((v) + 3)
+#define SYM16(v) SYM4(v), SYM4((v) + 4), SYM4((v) + 8), SYM4((v) + 12)
+#define SYM64(v) SYM16(v), SYM16((v) + 16), SYM16((v) + 32), SYM16((v) + 48)
+
+static const uint32_t ws2812_symbols[256] = {
+	SYM64(0), SYM64(64), SYM64(128), SYM64(192)
+};
+
+static inline unsigned char * channel_encode(uint8_t val, unsigned char *buf)
+{
+	*(uint32_t *) buf = ws2812_symbols[val];
+
+	return buf + BYTES_PER_CHANNEL;
+}
+#else
+static inline unsigned char * channel_encode(uint8_t val, unsigned char *buf)
+{
+	int i;
+
+	for(i = 0; i < BYTES_PER_CHANNEL; i++)
+	{
+		switch(val & 3)
+		{
+			case 0: *buf++ = 0x88; break;
+			case 1: *buf++ = 0x8e; break;
+			case 2: *buf++ = 0xe8; break;
+			case 3: *buf++ = 0xee; break;
+		}
+		val >>= 2;
+	}
+
+	return buf;
+}
+#endif
+
+/* 3 symbol patterns for every colour byte, bit n of the byte becomes bits
+ * 3n to 3n + 2 of the 24 bit pattern, MSB first like the nibble encoders.
+ */
+#define SYM3_BIT(v, n) ((((v) >> (n)) & 1 ? 0x6U : 0x4U) << (3 * (n)))
+#define SYM3(v)    (SYM3_BIT(v, 0) | SYM3_BIT(v, 1) | SYM3_BIT(v, 2) | SYM3_BIT(v, 3) | \
+                    SYM3_BIT(v, 4) | SYM3_BIT(v, 5) | SYM3_BIT(v, 6) | SYM3_BIT(v, 7))
+#define SYM3_4(v)  SYM3(v), SYM3((v) + 1), SYM3((v) + 2), SYM3((v) + 3)
+#define SYM3_16(v) SYM3_4(v), SYM3_4((v) + 4), SYM3_4((v) + 8), SYM3_4((v) + 12)
+#define SYM3_64(v) SYM3_16(v), SYM3_16((v) + 16), SYM3_16((v) + 32), SYM3_16((v) + 48)
+
+static const uint32_t ws2812_symbols3[256] = {
+	SYM3_64(0), SYM3_64(64), SYM3_64(128), SYM3_64(192)
+};
+
+/*
+ * Encode a channel at 3 symbols per bit starting at byte pos of the bit
+ * stream.  An LED does not make whole words so it starts part way into
+ * one, the PWM shifts each little endian word out MSB first which puts
+ * byte n of the bit stream at n ^ 3 in memory.
+ */
+static inline int channel_encode3(uint8_t val, unsigned char *base, int pos)
+{
+	uint32_t sym = ws2812_symbols3[val];
+
+	base[(pos + 0) ^ 3] = sym >> 16;
+	base[(pos + 1) ^ 3] = sym >> 8;
+	base[(pos + 2) ^ 3] = sym;
+
+	return pos + BYTES_PER_CHANNEL3;
+}
+
+/* How the channels of an LED are sent, the encoders read channel n from
+ * bits shift[n] of each RGB32 pixel
+ */
+struct ws2812_layout {
+	const char *           order;
+	int                    channels;
+	uint8_t                shift[WS2812_MAX_CHANNELS];
+	void (*encode)(const uint8_t (*lut)[256], const uint32_t *pixels,
+	               unsigned char *buf, int count);
+	void (*encode3)(const uint8_t (*lut)[256], const uint32_t *pixels,
+	                unsigned char *base, int led, int count);
+};
+
+/*
+ * Encoders for each pixel layout, generated with the channel count and the
+ * position of each channel in the RGB32 input fixed at compile time so
+ * the per pixel loop has no branches.  The input is 0xWWRRGGBB.
+ */
+#define CH_R 16
+#define CH_G 8
+#define CH_B 0
+#define CH_W 24
+
+#define CH_ENCODE(n, s) \
+	if((n) < channels) \
+		buf = channel_encode(lut[n][(px >> (s)) & 0xff], buf)
+
+#define CH_ENCODE3(n, s) \
+	if((n) < channels) \
+		pos = channel_encode3(lut[n][(px >> (s)) & 0xff], base, pos)
+
+#define WS2812_LAYOUT(order, nch, s0, s1, s2, s3) \
+static void ws2812_encode_##order(const uint8_t (*lut)[256], \
+                                  const uint32_t *pixels, \
+                                  unsigned char *buf, int count) \
+{ \
+	const int channels = (nch); \
+	uint32_t px; \
+\
+	while(count--) \
+	{ \
+		px = *pixels++; \
+		CH_ENCODE(0, s0); \
+		CH_ENCODE(1, s1); \
+		CH_ENCODE(2, s2); \
+		CH_ENCODE(3, s3); \
+	} \
+} \
+\
+static void ws2812_encode3_##order(const uint8_t (*lut)[256], \
+                                   const uint32_t *pixels, \
+                                   unsigned char *base, int led, int count) \
+{ \
+	const int channels = (nch); \
+	int pos = led * channels * BYTES_PER_CHANNEL3; \
+	uint32_t px; \
+\
+	while(count--) \
+	{ \
+		px = *pixels++; \
+		CH_ENCODE3(0, s0); \
+		CH_ENCODE3(1, s1); \
+		CH_ENCODE3(2, s2); \
+		CH_ENCODE3(3, s3); \
+	} \
+}
+
+#define WS2812_LAYOUT_ENTRY(order, nch, s0, s1, s2, s3) \
+	{ #order, (nch), { s0, s1, s2, s3 }, \
+	  ws2812_encode_##order, ws2812_encode3_##order },
+
+/* Supported layouts, the first is the default order the original strips use */
+#define WS2812_LAYOUTS(X) \
+	X(gbr,  3, CH_G, CH_B, CH_R, 0) \
+	X(grb,  3, CH_G, CH_R, CH_B, 0) \
+	X(rgb,  3, CH_R, CH_G, CH_B, 0) \
+	X(rbg,  3, CH_R, CH_B, CH_G, 0) \
+	X(brg,  3, CH_B, CH_R, CH_G, 0) \
+	X(bgr,  3, CH_B, CH_G, CH_R, 0) \
+	X(grbw, 4, CH_G, CH_R, CH_B, CH_W) \
+	X(rgbw, 4, CH_R, CH_G, CH_B, CH_W)
+
+WS2812_LAYOUTS(WS2812_LAYOUT)
+
+static const struct ws2812_layout ws2812_layouts[] = {
+	WS2812_LAYOUTS(WS2812_LAYOUT_ENTRY)
+};
+
+/* t / 255 rounded, for t up to 255 * 255 + 255 */
+static inline uint32_t ws2812_div255(uint32_t t)
+{
+	return (t + 128 + ((t + 128) >> 8)) >> 8;
+}
+
+/*
+ * Blend count pixels of an ARGB32 layer into RGB32 pixels in place with the
+ * WS2812_BLEND_* mode, the white channel of RGBW pixels is covered by the
+ * alpha as well
+ */
+static inline void ws2812_blend_scalar(uint32_t *dst, const uint32_t *src,
+                                       u32 mode, int count)
+{
+	uint32_t a, d, c, out;
+	int i, shift;
+
+	for(i = 0; i < count; i++)
+	{
+		a = src[i] >> 24;
+		d = dst[i];
+		out = 0;
+
+		for(shift = 0; shift < 24; shift += 8)
+		{
+			c = (src[i] >> shift) & 0xff;
+			if(mode == WS2812_BLEND_ADD)
+			{
+				c = ((d >> shift) & 0xff) + ws2812_div255(c * a);
+				if(c > 255)
+					c = 255;
+			}
+			else
+			{
+				c = ws2812_div255(((d >> shift) & 0xff) * (255 - a) + c * a);
+			}
+			out |= c << shift;
+		}
+
+		if(mode == WS2812_BLEND_ADD)
+			out |= d & 0xff000000;
+		else
+			out |= ws2812_div255((d >> 24) * (255 - a)) << 24;
+
+		dst[i] = out;
+	}
+}
+
+/*
+ * Add the blue, green and red bytes of count XRGB8888 pixels to sums[0],
+ * sums[1] and sums[2], the rest of a row after ws2812_sum_neon()
+ */
+static inline void ws2812_sum_scalar(const uint32_t *pixels, int count,
+                                     uint32_t *sums)
+{
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		sums[0] += pixels[i] & 0xff;
+		sums[1] += (pixels[i] >> 8) & 0xff;
+		sums[2] += (pixels[i] >> 16) & 0xff;
+	}
+}
+
+/*
+ * Average of a channel from its sum over area pixels, rounded with halves
+ * up.  recip is 2^53 / area rounded up, which makes this exact division
+ * of 2 * sum + area by 2 * area for areas up to WS2812_SAMPLE_MAX_AREA.
+ */
+static inline u32 ws2812_sample_scale(u32 sum, u32 area, u64 recip)
+{
+	return ((2 * (u64) sum + area) * recip) >> 54;
+}
+
+/* Rectangle of a sampled frame, offset is the byte offset of its top left
+ * pixel from the start of the buffer and recip 2^53 / its area rounded
+ * up, so the averages need no division
+ */
+struct ws2812_sample_rect {
+	u32                    offset;
+	u16                    width;
+	u16                    height;
+	u64                    recip;
+};
+
+// Most pixels summed per claim of the NEON unit, 256KB of frame
+#define WS2812_SAMPLE_CHUNK 65536
+
+/* The kernel claims NEON around each chunk of rows, host builds always
+ * have it, real or emulated, and have nothing to claim
+ */
+#ifdef __KERNEL__
+#ifdef CONFIG_KERNEL_MODE_NEON
+#define ws2812_sample_neon_begin() kernel_neon_begin()
+#define ws2812_sample_neon_end()   kernel_neon_end()
+#endif
+#else
+#define ws2812_sample_neon_begin() do { } while(0)
+#define ws2812_sample_neon_end()   do { } while(0)
+#endif
+
+/*
+ * Average the XRGB8888 pixels of a rectangle into an RGB32 colour.  With
+ * neon set the rows are summed with NEON, claimed for at most
+ * WS2812_SAMPLE_CHUNK pixels at a time so the largest rectangle does not
+ * hold off preemption for long.  The caller checks NEON is usable.
+ */
+static inline uint32_t ws2812_average_rect(const uint8_t *frame, u32 stride,
+                                           const struct ws2812_sample_rect *rect,
+                                           bool neon)
+{
+	u32 area = (u32) rect->width * rect->height;
+	int rows = rect->height;
+	u32 sums[3] = { 0, 0, 0 };
+	const uint32_t *row;
+	int x, y, end;
+
+	/* At least one row, rectangles are under 65536 pixels wide */
+	if(neon && (u32) rect->width * rows > WS2812_SAMPLE_CHUNK)
+		rows = WS2812_SAMPLE_CHUNK / rect->width;
+
+	for(y = 0; y < rect->height; )
+	{
+		end = rect->height - y < rows ? rect->height : y + rows;
+#ifdef ws2812_sample_neon_begin
+		if(neon)
+			ws2812_sample_neon_begin();
+#endif
+		for(; y < end; y++)
+		{
+			row = (const uint32_t *) (frame + rect->offset + y * stride);
+			x = 0;
+#ifdef ws2812_sample_neon_begin
+			if(neon)
+				x = ws2812_sum_neon(row, rect->width, sums);
+#endif
+			ws2812_sum_scalar(row + x, rect->width - x, sums);
+		}
+#ifdef ws2812_sample_neon_begin
+		if(neon)
+			ws2812_sample_neon_end();
+#endif
+	}
+
+	return ws2812_sample_scale(sums[2], area, rect->recip) << 16 |
+	       ws2812_sample_scale(sums[1], area, rect->recip) << 8 |
+	       ws2812_sample_scale(sums[0], area, rect->recip);
+}
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Raspberry Pi WS2812 PWM driver
+ *
+ * Userspace interface to /dev/ws2812-<n>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _WS2812_IOCTL_H
+#define _WS2812_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define WS2812_IOC_MAGIC 0xb5
+
+/*
+ * Layout of the pixel slots that can be mmap()ed from /dev/ws2812-<n>.
+ * Slot n starts at offset n * slot_size and holds num_leds RGB32 pixels.
+ * Render into slot next and pass it to WS2812_IOC_COMMIT.
+ */
+struct ws2812_info {
+	__u32 num_leds;
+	__u32 slots;
+	__u32 slot_size;
+	__u32 next;
+};
+
+/*
+ * Send the pixels in slot, on return next is the slot to render the
+ * following frame into
+ */
+struct ws2812_commit {
+	__u32 slot;
+	__u32 next;
+};
+
+/*
+ * Frame to send at a CLOCK_MONOTONIC target time, pixels points at
+ * num_leds RGB32 pixels.  The frame is encoded straight away and queued,
+ * seq is returned to match it with its ws2812_frame_status.
+ */
+struct ws2812_timed_frame {
+	__u64 pixels;
+	__u32 num_leds;
+	__u32 seq;
+	__s64 target_ns;
+};
+
+/*
+ * Animation queued in one call, pixels points at num_frames frames of
+ * num_leds RGB32 pixels one after the other and durations at num_frames
+ * __u32 microsecond durations.  The first frame is sent at start_ns and
+ * each following one when the previous one's duration is up.  On return
+ * queued is how many frames, from the first, fitted in the timed queue
+ * and seq is the seq of the first of them, the rest follow in order.
+ */
+struct ws2812_batch {
+	__u64 pixels;
+	__u64 durations;
+	__u32 num_frames;
+	__u32 num_leds;
+	__s64 start_ns;
+	__u32 queued;
+	__u32 seq;
+};
+
+#define WS2812_FRAME_DROPPED (1 << 0)
+
+/*
+ * Result of a timed frame, actual_ns is when it started to be sent, or 0
+ * if it was dropped because a newer frame replaced it first
+ */
+struct ws2812_frame_status {
+	__u32 seq;
+	__u32 flags;
+	__s64 target_ns;
+	__s64 actual_ns;
+};
+
+/* Effects the driver can run on its own, see struct ws2812_effect */
+#define WS2812_EFFECT_NONE     0
+#define WS2812_EFFECT_FADE     1
+#define WS2812_EFFECT_CHASE    2
+#define WS2812_EFFECT_RAINBOW  3
+
+#define WS2812_EFFECT_COLOURS  16
+
+/* Longest period_ms accepted, one day */
+#define WS2812_EFFECT_MAX_PERIOD_MS (24 * 60 * 60 * 1000)
+
+/*
+ * Effect generated by the driver at fps frames per second until the next
+ * frame arrives from userspace.  Colours are RGB32 like written pixels.
+ *
+ * FADE     the whole strip fades through the first num_colours palette
+ *          entries in turn, each keyframe taking period_ms / num_colours,
+ *          a colour and black gives a breathing effect
+ * CHASE    the palette is repeated along the strip and moves one LED at a
+ *          time, advancing a whole palette length every period_ms
+ * RAINBOW  a colour wheel spread over the strip that turns once every
+ *          period_ms, the palette is not used
+ */
+struct ws2812_effect {
+	__u32 type;
+	__u32 period_ms;
+	__u32 fps;
+	__u32 num_colours;
+	__u32 palette[WS2812_EFFECT_COLOURS];
+};
+
+/*
+ * Pixel formats accepted by write(), set per open file
+ *
+ * RGB32   0xWWRRGGBB native endian words, the default and the format of
+ *         every other interface
+ * RGB24   packed bytes R, G, B
+ * RGB565  native endian 16 bit words, 5 bits red, 6 green, 5 blue
+ * PAL8    one byte per LED indexing the palette set with
+ *         WS2812_IOC_SET_PALETTE, initially all black
+ */
+#define WS2812_FORMAT_RGB32    0
+#define WS2812_FORMAT_RGB24    1
+#define WS2812_FORMAT_RGB565   2
+#define WS2812_FORMAT_PAL8     3
+
+#define WS2812_PALETTE_SIZE    256
+
+/* RGB32 colours for WS2812_FORMAT_PAL8 */
+struct ws2812_palette {
+	__u32 colours[WS2812_PALETTE_SIZE];
+};
+
+/* Overlay layers blended over every frame, in order */
+#define WS2812_LAYERS          4
+
+#define WS2812_BLEND_OFF       0
+#define WS2812_BLEND_OVER      1
+#define WS2812_BLEND_ADD       2
+
+/*
+ * Set the blend mode of a layer and update num_leds of its pixels from
+ * first on, pixels points at ARGB32 values, alpha in the top byte.
+ *
+ * OVER  the layer is drawn over the frame, alpha 255 is opaque
+ * ADD   the layer scaled by alpha is added to the frame, saturating
+ * OFF   the layer is removed and its pixels cleared
+ */
+struct ws2812_layer {
+	__u32 layer;
+	__u32 mode;
+	__u32 first;
+	__u32 num_leds;
+	__u64 pixels;
+};
+
+/*
+ * Frame to encode once and keep in the driver's cache, pixels points at
+ * num_leds RGB32 pixels.  Returns the handle to show it with
+ * WS2812_IOC_SHOW_CACHED, which fails with ENOENT once the frame has been
+ * evicted to make room for newer ones.
+ */
+struct ws2812_cached_frame {
+	__u64 pixels;
+	__u32 num_leds;
+	__u32 handle;
+};
+
+/* Region of a sampled frame averaged into one LED, in pixels */
+struct ws2812_rect {
+	__u16 x;
+	__u16 y;
+	__u16 width;
+	__u16 height;
+};
+
+/*
+ * Frame imported from a dma-buf for ambilight sampling.  The frame holds
+ * width x height XRGB8888 pixels, rows stride bytes apart from offset
+ * into the buffer.  rects points at num_leds rectangles, LED n shows the
+ * average colour of rectangle n.  fd -1 releases the imported buffer,
+ * so does closing the file that imported it.  A map that fails to import
+ * keeps the previous one.
+ */
+struct ws2812_sampling {
+	__s32 fd;
+	__u32 width;
+	__u32 height;
+	__u32 stride;
+	__u32 offset;
+	__u32 num_leds;
+	__u64 rects;
+};
+
+#define WS2812_IOC_INFO     _IOR(WS2812_IOC_MAGIC, 0, struct ws2812_info)
+#define WS2812_IOC_COMMIT   _IOWR(WS2812_IOC_MAGIC, 1, struct ws2812_commit)
+
+/*
+ * Frame clock in Hz, the newest frame submitted is sent on each tick and
+ * older ones are dropped.  0 sends every frame as soon as possible.
+ */
+#define WS2812_IOC_SET_REFRESH _IOW(WS2812_IOC_MAGIC, 2, __u32)
+
+/*
+ * Queue a frame for its target time, fails with EAGAIN while the queue is
+ * full.  Results are collected oldest first with WS2812_IOC_FRAME_STATUS,
+ * which fails with EAGAIN when there are none.
+ */
+#define WS2812_IOC_QUEUE_FRAME  _IOWR(WS2812_IOC_MAGIC, 3, struct ws2812_timed_frame)
+#define WS2812_IOC_FRAME_STATUS _IOR(WS2812_IOC_MAGIC, 4, struct ws2812_frame_status)
+
+/*
+ * Queue frames of a struct ws2812_batch for their targets, only fails if
+ * the first frame cannot be queued, EAGAIN when the queue is full
+ */
+#define WS2812_IOC_QUEUE_BATCH  _IOWR(WS2812_IOC_MAGIC, 11, struct ws2812_batch)
+
+/* Start an effect, or stop it with WS2812_EFFECT_NONE */
+#define WS2812_IOC_SET_EFFECT   _IOW(WS2812_IOC_MAGIC, 5, struct ws2812_effect)
+
+/* Pixel format for write() on this file, and the palette for PAL8 */
+#define WS2812_IOC_SET_FORMAT   _IOW(WS2812_IOC_MAGIC, 6, __u32)
+#define WS2812_IOC_SET_PALETTE  _IOW(WS2812_IOC_MAGIC, 7, struct ws2812_palette)
+
+#define WS2812_IOC_SET_LAYER    _IOW(WS2812_IOC_MAGIC, 8, struct ws2812_layer)
+
+#define WS2812_IOC_CACHE_FRAME  _IOWR(WS2812_IOC_MAGIC, 9, struct ws2812_cached_frame)
+#define WS2812_IOC_SHOW_CACHED  _IOW(WS2812_IOC_MAGIC, 10, __u32)
+
+/*
+ * Import a dma-buf and its sampling map, then show the averages of the
+ * frame currently in it each time WS2812_IOC_SAMPLE is called, for
+ * example once the producer has finished writing a video frame.
+ */
+#define WS2812_IOC_SET_SAMPLING _IOW(WS2812_IOC_MAGIC, 12, struct ws2812_sampling)
+#define WS2812_IOC_SAMPLE       _IO(WS2812_IOC_MAGIC, 13)
+
+#endif
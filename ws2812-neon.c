@@ -0,0 +1,168 @@
+/*
+ * Raspberry Pi WS2812 PWM driver
+ *
+ * NEON batch encoder, produces the same output as the pixel layout
+ * encoders in ws2812-core.c for eight pixels at a time, and the layer
+ * blending and frame sampling helpers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef CONFIG_ARM64
+#include <asm/neon-intrinsics.h>
+#else
+#include <arm_neon.h>
+#endif
+
+#include "ws2812.h"
+#include "ws2812-ioctl.h"
+
+/*
+ * Expand eight colour bytes into their symbol words, bits 2n+1:2n of each
+ * byte select byte n of its word.  Returns the words for pixels 0-3 in lo
+ * and 4-7 in hi.
+ */
+static inline void ws2812_expand(uint8x8_t val, uint8x8_t sym, uint8x8_t mask,
+                                 uint32x4_t *lo, uint32x4_t *hi)
+{
+	uint8x8_t b0 = vtbl1_u8(sym, vand_u8(val, mask));
+	uint8x8_t b1 = vtbl1_u8(sym, vand_u8(vshr_n_u8(val, 2), mask));
+	uint8x8_t b2 = vtbl1_u8(sym, vand_u8(vshr_n_u8(val, 4), mask));
+	uint8x8_t b3 = vtbl1_u8(sym, vshr_n_u8(val, 6));
+	uint8x8x2_t b01 = vzip_u8(b0, b1);
+	uint8x8x2_t b23 = vzip_u8(b2, b3);
+	uint16x4x2_t w0 = vzip_u16(vreinterpret_u16_u8(b01.val[0]),
+	                           vreinterpret_u16_u8(b23.val[0]));
+	uint16x4x2_t w1 = vzip_u16(vreinterpret_u16_u8(b01.val[1]),
+	                           vreinterpret_u16_u8(b23.val[1]));
+
+	*lo = vreinterpretq_u32_u16(vcombine_u16(w0.val[0], w0.val[1]));
+	*hi = vreinterpretq_u32_u16(vcombine_u16(w1.val[0], w1.val[1]));
+}
+
+int ws2812_encode_neon(const uint8_t (*lut)[256], const uint8_t *shift,
+                       int channels, const uint32_t *pixels,
+                       uint32_t *out, int count)
+{
+	static const uint8_t symbols[8] = { 0x88, 0x8e, 0xe8, 0xee };
+	uint8x8_t sym = vld1_u8(symbols);
+	uint8x8_t mask = vdup_n_u8(3);
+	uint8_t chan[WS2812_MAX_CHANNELS][WS2812_NEON_BATCH];
+	int i, c, n;
+
+	for(n = 0; n + WS2812_NEON_BATCH <= count; n += WS2812_NEON_BATCH)
+	{
+		uint32x4x4_t lo, hi;
+
+		/* NEON has no 256 entry table lookup, so reorder the channels
+		 * and apply the gamma tables into planar form first
+		 */
+		for(i = 0; i < WS2812_NEON_BATCH; i++)
+		{
+			uint32_t px = pixels[n + i];
+
+			for(c = 0; c < channels; c++)
+				chan[c][i] = lut[c][(px >> shift[c]) & 0xff];
+		}
+
+		for(c = 0; c < channels; c++)
+			ws2812_expand(vld1_u8(chan[c]), sym, mask,
+			              &lo.val[c], &hi.val[c]);
+
+		/* Interleave the channel words, one word per channel */
+		if(channels == 4)
+		{
+			vst4q_u32(out, lo);
+			vst4q_u32(out + 4 * 4, hi);
+		}
+		else
+		{
+			uint32x4x3_t lo3 = { { lo.val[0], lo.val[1], lo.val[2] } };
+			uint32x4x3_t hi3 = { { hi.val[0], hi.val[1], hi.val[2] } };
+
+			vst3q_u32(out, lo3);
+			vst3q_u32(out + 4 * 3, hi3);
+		}
+		out += WS2812_NEON_BATCH * channels;
+	}
+
+	return n;
+}
+
+/* t / 255 rounded, for t up to 255 * 255 + 255 */
+static inline uint8x8_t ws2812_div255(uint16x8_t t)
+{
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+int ws2812_blend_neon(uint32_t *dst, const uint32_t *src, u32 mode, int count)
+{
+	int c, n;
+
+	for(n = 0; n + WS2812_NEON_BATCH <= count; n += WS2812_NEON_BATCH)
+	{
+		/* Planar B, G, R and alpha or white */
+		uint8x8x4_t d = vld4_u8((const uint8_t *) (dst + n));
+		uint8x8x4_t s = vld4_u8((const uint8_t *) (src + n));
+		uint8x8_t a = s.val[3];
+		uint8x8_t ia = vmvn_u8(a);
+
+		if(mode == WS2812_BLEND_ADD)
+		{
+			for(c = 0; c < 3; c++)
+				d.val[c] = vqadd_u8(d.val[c],
+				                    ws2812_div255(vmull_u8(s.val[c], a)));
+		}
+		else
+		{
+			for(c = 0; c < 3; c++)
+				d.val[c] = ws2812_div255(vmlal_u8(vmull_u8(d.val[c], ia),
+				                                  s.val[c], a));
+			d.val[3] = ws2812_div255(vmull_u8(d.val[3], ia));
+		}
+
+		vst4_u8((uint8_t *) (dst + n), d);
+	}
+
+	return n;
+}
+
+int ws2812_sum_neon(const uint32_t *pixels, int count, uint32_t *sums)
+{
+	uint32x4_t acc[3];
+	uint16x8_t part[3];
+	int c, i, n = 0;
+
+	for(c = 0; c < 3; c++)
+		acc[c] = vdupq_n_u32(0);
+
+	while(n + WS2812_NEON_BATCH <= count)
+	{
+		/* 16 bit lanes hold 257 bytes, fold them into the 32 bit sums
+		 * every 256 batches
+		 */
+		for(c = 0; c < 3; c++)
+			part[c] = vdupq_n_u16(0);
+
+		for(i = 0; i < 256 && n + WS2812_NEON_BATCH <= count; i++)
+		{
+			/* Planar B, G, R and the unused byte */
+			uint8x8x4_t px = vld4_u8((const uint8_t *) (pixels + n));
+
+			for(c = 0; c < 3; c++)
+				part[c] = vaddw_u8(part[c], px.val[c]);
+			n += WS2812_NEON_BATCH;
+		}
+
+		for(c = 0; c < 3; c++)
+			acc[c] = vpadalq_u16(acc[c], part[c]);
+	}
+
+	for(c = 0; c < 3; c++)
+		sums[c] += vgetq_lane_u32(acc[c], 0) + vgetq_lane_u32(acc[c], 1) +
+		           vgetq_lane_u32(acc[c], 2) + vgetq_lane_u32(acc[c], 3);
+
+	return n;
+}
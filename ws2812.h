@@ -0,0 +1,50 @@
+/*
+ * Raspberry Pi WS2812 PWM driver
+ *
+ * Definitions shared between the driver core and the NEON encoder
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _WS2812_H
+#define _WS2812_H
+
+#include <linux/types.h>
+
+// Most colour channels per LED, 4 for RGBW
+#define WS2812_MAX_CHANNELS 4
+
+// Pixels encoded per pass of the NEON encoder
+#define WS2812_NEON_BATCH 8
+
+// Largest sampled rectangle, keeps the rounded averages exact
+#define WS2812_SAMPLE_MAX_AREA (1 << 22)
+
+/*
+ * Encode as many whole batches of RGB32 pixels as possible into PWM symbol
+ * words, one word per channel, using the per channel lookup tables.
+ * Channel n of a pixel is taken from bits shift[n] of it.  Returns the
+ * number of pixels encoded, the caller encodes the remainder.  Must be
+ * called between kernel_neon_begin() and kernel_neon_end().
+ */
+int ws2812_encode_neon(const uint8_t (*lut)[256], const uint8_t *shift,
+                       int channels, const uint32_t *pixels,
+                       uint32_t *out, int count);
+
+/*
+ * Blend whole batches of an ARGB32 layer into RGB32 pixels in place with
+ * the WS2812_BLEND_* mode.  Returns the number of pixels blended, same
+ * rules as ws2812_encode_neon().
+ */
+int ws2812_blend_neon(uint32_t *dst, const uint32_t *src, u32 mode, int count);
+
+/*
+ * Add the blue, green and red bytes of whole batches of XRGB8888 pixels
+ * to sums[0], sums[1] and sums[2].  Returns the number of pixels summed,
+ * same rules as ws2812_encode_neon().
+ */
+int ws2812_sum_neon(const uint32_t *pixels, int count, uint32_t *sums);
+
+#endif